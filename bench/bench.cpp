@@ -0,0 +1,293 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <boost/program_options.hpp>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+// every heap allocation of the process is counted, so a case's allocations/op
+// and bytes/op include everything it copies into fresh buffers.
+static atomic<uint64_t> allocations{0};
+static atomic<uint64_t> allocated_bytes{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    allocated_bytes.fetch_add(size, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+// operator new above allocates with malloc, so free is the matching release;
+// gcc can't see that once both are inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#pragma GCC diagnostic pop
+
+struct Measurement {
+    double ns;
+    double allocations;
+    double bytes;
+};
+
+template <typename F>
+Measurement measure(F f, double min_seconds) {
+    f();
+
+    uint64_t iterations = 0;
+    uint64_t allocations_before = allocations;
+    uint64_t bytes_before = allocated_bytes;
+    auto begin = chrono::steady_clock::now();
+    auto elapsed = chrono::steady_clock::duration::zero();
+    do {
+        f();
+        iterations++;
+        elapsed = chrono::steady_clock::now() - begin;
+    } while (chrono::duration<double>(elapsed).count() < min_seconds);
+
+    return {
+        chrono::duration<double, nano>(elapsed).count() / iterations,
+        double(allocations - allocations_before) / iterations,
+        double(allocated_bytes - bytes_before) / iterations
+    };
+}
+
+// keeps the optimizer from dropping a result: the empty asm takes the value's
+// address and clobbers memory, so the value must be fully built before it.
+template <typename T>
+void consume(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+string words(size_t count, size_t seed) {
+    static const char* vocabulary[] = {
+        "the", "model", "returns", "a", "response", "for", "given", "conversation",
+        "tokens", "embedding", "vector", "request", "latency", "server", "client", "stream"
+    };
+    string text;
+    for (size_t i = 0; i < count; i++) {
+        if (i) text += ' ';
+        text += vocabulary[(seed + i * 7) % 16];
+    }
+    return text;
+}
+
+// roughly 1000 tokens spread over a system prompt and ten turns.
+json chat_request() {
+    json messages = json::array();
+    messages.push_back({{ "role", "system" }, { "content", words(100, 0) }});
+    for (size_t i = 0; i < 10; i++) {
+        messages.push_back({{ "role", i % 2 ? "assistant" : "user" }, { "content", words(75, i) }});
+    }
+    return {{ "model", "gpt-4o" }, { "messages", messages }, { "temperature", 0.7 }};
+}
+
+json embedding_request() {
+    json input = json::array();
+    for (size_t i = 0; i < 2048; i++) {
+        input.push_back(words(12, i));
+    }
+    return {{ "model", "text-embedding-3-large" }, { "input", input }};
+}
+
+string chat_response() {
+    json response = {
+        { "id", "chatcmpl-bench" },
+        { "object", "chat.completion" },
+        { "model", "gpt-4o" },
+        { "choices", {{
+            { "index", 0 },
+            { "message", {{ "role", "assistant" }, { "content", words(750, 3) }} },
+            { "finish_reason", "stop" }
+        }}},
+        { "usage", {{ "prompt_tokens", 1000 }, { "completion_tokens", 1000 }, { "total_tokens", 2000 }} }
+    };
+    return response.dump();
+}
+
+string embedding_response() {
+    vector<float> embedding(3072);
+    for (size_t i = 0; i < embedding.size(); i++) {
+        embedding[i] = float((i * 2654435761u) % 20000) / 10000.0f - 1.0f;
+    }
+    json response = {
+        { "object", "list" },
+        { "data", {{ { "object", "embedding" }, { "index", 0 }, { "embedding", embedding } }} },
+        { "model", "text-embedding-3-large" },
+        { "usage", {{ "prompt_tokens", 8 }, { "total_tokens", 8 }} }
+    };
+    return response.dump();
+}
+
+int main(int argc, char * argv[]) {
+    po::options_description opts;
+    opts.add_options()
+                    ("help,h", "show this help message and exit")
+                    ("min-time", po::value<double>()->default_value(0.5), "seconds spent on each case.")
+                    ("filter", po::value<string>()->default_value(""), "only run cases whose name contains this.")
+                    ("baseline", po::value<string>(), "compare against a baseline file, exit 1 on regression.")
+                    ("save-baseline", po::value<string>(), "write the results as a baseline file, e.g. bench/local.json before a change.")
+                    ("portable", "[--save-baseline] leave ns/op out, as in the committed bench/baseline.json.")
+                    ("tolerance", po::value<double>()->default_value(0.10), "allowed ns/op slowdown against the baseline.")
+                    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    if (vm.count("help") > 0) {
+        cout << opts << endl;
+        return 0;
+    }
+
+    double min_time = vm["min-time"].as<double>();
+    string filter = vm["filter"].as<string>();
+
+    json chat = chat_request();
+    json embedding = embedding_request();
+    string chat_body = chat_response();
+    string embedding_body = embedding_response();
+    string speech_body(1 << 20, '\xff');
+
+    string audio_path = "bench_audio.mp3";
+    {
+        ofstream os(audio_path, ios::binary);
+        os << string(1 << 20, '\x01');
+    }
+    string image_path = "bench_image.png";
+    string mask_path = "bench_mask.png";
+    {
+        ofstream image(image_path, ios::binary);
+        image << string(1 << 20, '\x02');
+        ofstream mask(mask_path, ios::binary);
+        mask << string(1 << 20, '\x03');
+    }
+    json edit = {
+        { "image", image_path },
+        { "mask", mask_path },
+        { "prompt", words(40, 5) },
+        { "model", "dall-e-2" },
+        { "n", 2 },
+        { "response_format", "url" }
+    };
+    json variation = {
+        { "image", image_path },
+        { "model", "dall-e-2" },
+        { "n", 2 },
+        { "response_format", "url" }
+    };
+
+    json transcription = {
+        { "file", audio_path },
+        { "model", "whisper-1" },
+        { "language", "en" },
+        { "response_format", "json" },
+        { "temperature", 0.2 }
+    };
+
+    vector<pair<string, function<void()>>> cases = {
+        { "dump_chat_1k_tokens", [&] { consume(chat.dump()); } },
+        { "dump_embedding_2048_inputs", [&] { consume(embedding.dump()); } },
+        { "multipart_transcription_1mb", [&] { consume(openai::CategoryAudio::transcription_items(transcription)); } },
+        { "multipart_image_edit_2x1mb", [&] { consume(openai::CategoryImages::edit_items(edit)); } },
+        { "multipart_image_variation_1mb", [&] { consume(openai::CategoryImages::variation_items(variation)); } },
+        { "decode_chat_response", [&] {
+            consume(openai::OpenAI::decode(make_tuple(0, chat_body)));
+        }},
+        { "decode_embedding_3072_dims", [&] {
+            consume(openai::OpenAI::decode(make_tuple(0, embedding_body)));
+        }},
+        { "decode_speech_1mb_fallback", [&] {
+            consume(openai::OpenAI::decode(make_tuple(0, speech_body)));
+        }},
+    };
+
+    cout << "decode cases include copying the body into the session result, as the" << endl
+         << "socket buffer would be." << endl << endl;
+    cout << left << setw(32) << "case" << right
+         << setw(14) << "ns/op"
+         << setw(14) << "allocs/op"
+         << setw(14) << "bytes/op"
+         << endl;
+
+    json results = json::object();
+    for (auto& c: cases) {
+        if (c.first.find(filter) == string::npos) continue;
+
+        Measurement m = measure(c.second, min_time);
+        results[c.first] = {{ "allocations", m.allocations }, { "bytes", m.bytes }};
+        if (vm.count("portable") == 0) {
+            results[c.first]["ns"] = m.ns;
+        }
+
+        cout << left << setw(32) << c.first << right
+             << fixed << setprecision(0)
+             << setw(14) << m.ns
+             << setprecision(1)
+             << setw(14) << m.allocations
+             << setprecision(0)
+             << setw(14) << m.bytes
+             << endl;
+    }
+    remove(audio_path.c_str());
+    remove(image_path.c_str());
+    remove(mask_path.c_str());
+
+    if (vm.count("save-baseline") > 0) {
+        ofstream os(vm["save-baseline"].as<string>());
+        os << results.dump(4) << endl;
+    }
+
+    int status = 0;
+    if (vm.count("baseline") > 0) {
+        ifstream is(vm["baseline"].as<string>());
+        if (!is.is_open()) {
+            cout << "can not open " << vm["baseline"].as<string>() << endl;
+            return 1;
+        }
+        json baseline = json::parse(is);
+        double tolerance = vm["tolerance"].as<double>();
+
+        cout << endl;
+        for (auto& result: results.items()) {
+            if (!baseline.contains(result.key())) continue;
+            const json& base = baseline[result.key()];
+            const json& now = result.value();
+
+            // allocations are deterministic, time is not: the committed baseline
+            // only has allocations and bytes, a local one saved before a change
+            // has ns/op too.
+            bool slower = base.contains("ns") && now.contains("ns") && 
+                          now["ns"].get<double>() > base["ns"].get<double>() * (1.0 + tolerance);
+            bool allocs = now["allocations"].get<double>() > base["allocations"].get<double>() + 0.5;
+            bool bytes = now["bytes"].get<double>() > base["bytes"].get<double>() * 1.01 + 64;
+            if (slower || allocs || bytes) {
+                status = 1;
+                cout << "regression: " << result.key()
+                     << (slower ? " ns/op" : "")
+                     << (allocs ? " allocs/op" : "")
+                     << (bytes ? " bytes/op" : "")
+                     << endl;
+            }
+        }
+        if (status == 0) {
+            cout << "no regressions against " << vm["baseline"].as<string>() << endl;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <boost/program_options.hpp>
+
+#include "../include/vector_store.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+vector<vector<float>> random_vectors(size_t n, size_t dims, mt19937& rng) {
+    normal_distribution<float> dist;
+    vector<vector<float>> vectors(n, vector<float>(dims));
+    for (auto& v: vectors) {
+        for (auto& x: v) x = dist(rng);
+    }
+    return vectors;
+}
+
+template <typename F>
+double seconds(F f) {
+    auto begin = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+void run(const openai::VectorStore& store, const vector<vector<float>>& queries, size_t k, size_t threads, const char* kind) {
+    size_t single = min<size_t>(queries.size(), 64);
+    double t1 = seconds([&] {
+        for (size_t i = 0; i < single; i++) store.search(queries[i], k);
+    });
+    double tn = seconds([&] { store.search(queries, k, threads); });
+
+    cout << setw(10) << store.size()
+         << setw(8) << kind
+         << setw(14) << fixed << setprecision(1) << single / t1
+         << setw(14) << queries.size() / tn
+         << setw(14) << setprecision(2) << store.size() * (single / t1) / 1e6
+         << endl;
+}
+
+int main(int argc, char * argv[]) {
+    po::options_description opts;
+    opts.add_options()
+                    ("help,h", "show this help message and exit")
+                    ("dims", po::value<size_t>()->default_value(1536), "embedding dimensions.")
+                    ("sizes", po::value<vector<size_t>>()->multitoken()->default_value({1000, 10000, 100000}, "1000 10000 100000"), "corpus sizes.")
+                    ("queries", po::value<size_t>()->default_value(256), "queries per batch.")
+                    ("k", po::value<size_t>()->default_value(10), "top-k.")
+                    ("threads", po::value<size_t>()->default_value(0), "batch threads, 0 for all cores.")
+                    ("file", po::value<string>()->default_value("vector_store.bin"), "scratch file for the mmap round trip.")
+                    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    if (vm.count("help") > 0) {
+        cout << opts << endl;
+        return 0;
+    }
+
+    size_t dims = vm["dims"].as<size_t>();
+    size_t k = vm["k"].as<size_t>();
+    size_t threads = vm["threads"].as<size_t>();
+    string file = vm["file"].as<string>();
+
+    mt19937 rng(42);
+    auto queries = random_vectors(vm["queries"].as<size_t>(), dims, rng);
+
+    cout << "kernel: " << openai::kernels::isa() << " dims: " << dims << " k: " << k << endl;
+    cout << setw(10) << "corpus"
+         << setw(8) << "type"
+         << setw(14) << "qps"
+         << setw(14) << "batch qps"
+         << setw(14) << "Mvec/s"
+         << endl;
+
+    for (auto size: vm["sizes"].as<vector<size_t>>()) {
+        openai::VectorStore store(dims);
+        store.reserve(size);
+        normal_distribution<float> dist;
+        vector<float> v(dims);
+        for (size_t i = 0; i < size; i++) {
+            for (auto& x: v) x = dist(rng);
+            store.add(v);
+        }
+        run(store, queries, k, threads, "float");
+
+        store.save(file);
+        openai::VectorStore mapped;
+        double open = seconds([&] { mapped = openai::VectorStore::open(file); });
+        run(mapped, queries, k, threads, "mmap");
+
+        store.quantize();
+        run(store, queries, k, threads, "int8");
+
+        cout << setw(10) << size << "  open " << setprecision(3) << open * 1e3 << " ms" << endl;
+    }
+    remove(file.c_str());
+
+    return 0;
+}
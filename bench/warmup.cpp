@@ -0,0 +1,121 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
+#include <boost/program_options.hpp>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+// a throwaway self-signed P-256 certificate for the local TLS server.
+tuple<X509*, EVP_PKEY*> self_signed() {
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY_keygen_init(ctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(ctx, &key);
+    EVP_PKEY_CTX_free(ctx);
+
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, 
+                               reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    return make_tuple(cert, key);
+}
+
+template <typename F>
+double milliseconds(F f) {
+    auto begin = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+void report(const char* name, vector<double> samples) {
+    sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for (auto s: samples) total += s;
+    cout << setw(6) << name 
+         << fixed << setprecision(3)
+         << "  mean " << setw(9) << total / samples.size() << " ms"
+         << "  p50 " << setw(9) << samples[samples.size() / 2] << " ms"
+         << "  max " << setw(9) << samples.back() << " ms" 
+         << endl;
+}
+
+int main(int argc, char * argv[]) {
+    po::options_description opts;
+    opts.add_options()
+                    ("help,h", "show this help message and exit")
+                    ("base-uri", po::value<string>()->default_value(""), "measure a remote scheme://host:port instead of a local tls server.")
+                    ("path", po::value<string>()->default_value("/v1/models"), "path of the first request.")
+                    ("rounds", po::value<size_t>()->default_value(20), "fresh sessions per mode.")
+                    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    if (vm.count("help") > 0) {
+        cout << opts << endl;
+        return 0;
+    }
+
+    string base_uri = vm["base-uri"].as<string>();
+    string path = vm["path"].as<string>();
+    size_t rounds = max<size_t>(1, vm["rounds"].as<size_t>());
+
+    unique_ptr<SSLServer> server;
+    thread listener;
+    if (base_uri.empty()) {
+        X509* cert;
+        EVP_PKEY* key;
+        tie(cert, key) = self_signed();
+        server.reset(new SSLServer(cert, key));
+        server->Get(path, [](const Request&, Response& res) {
+            res.set_content("{\"object\":\"list\",\"data\":[]}", "application/json");
+        });
+        int port = server->bind_to_any_port("127.0.0.1");
+        listener = thread([&] { server->listen_after_bind(); });
+        server->wait_until_ready();
+        base_uri = "https://127.0.0.1:" + to_string(port);
+    }
+
+    vector<double> cold, warm;
+    for (size_t i = 0; i < rounds; i++) {
+        {
+            openai::Session session(base_uri);
+            session.enable_server_certificate_verification(false);
+            cold.push_back(milliseconds([&] { session.get(path); }));
+        }
+        {
+            openai::Session session(base_uri);
+            session.enable_server_certificate_verification(false);
+            session.warmup(1, path).wait();
+            warm.push_back(milliseconds([&] { session.get(path); }));
+        }
+    }
+
+    cout << "first request to " << base_uri << path << " over " << rounds << " sessions" << endl;
+    report("cold", cold);
+    report("warm", warm);
+
+    if (server) {
+        server->stop();
+        listener.join();
+    }
+
+    return 0;
+}
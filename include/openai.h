@@ -4,10 +4,39 @@
 #include <fstream>
 #include <tuple>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <future>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <type_traits>
+#include <cstring>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <array>
+#include <algorithm>
+#include <shared_mutex>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <nlohmann/json.hpp>
 
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 #include <httplib.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <openssl/ssl.h>
 
 using namespace std;
 using namespace httplib;
@@ -17,215 +46,1787 @@ using json = nlohmann::json;
 namespace openai {
     using session_result = tuple<int, string> ;
 
+    // cancels the calls it is passed to, from any thread, before they start or
+    // while uploading or receiving the response. a tcp connect already under way
+    // is not interrupted; it runs until connection_timeout (capped by the
+    // deadline) and the call then reports "Canceled". copies share the same
+    // state, so a token can be handed to several calls at once.
+    class CancellationToken {
+        struct State {
+            atomic<bool> cancelled{false};
+            mutex lock;
+            size_t next = 0;
+            unordered_map<size_t, function<void()>> hooks;
+        };
+
+        shared_ptr<State> state_;
+
+        public:
+            CancellationToken() : 
+                state_{make_shared<State>()} {}
+            CancellationToken(nullptr_t) {}
+
+            explicit operator bool() const { return static_cast<bool>(state_); }
+
+            void cancel();
+            bool cancelled() const;
+
+            size_t on_cancel(function<void()> hook) const;
+            void remove(size_t id) const;
+    };
+
+    inline void CancellationToken::cancel() {
+        if (!state_) return;
+
+        lock_guard<mutex> guard(state_->lock);
+        if (state_->cancelled.exchange(true)) return;
+        for (auto& hook: state_->hooks) {
+            hook.second();
+        }
+    }
+
+    inline bool CancellationToken::cancelled() const {
+        return state_ && state_->cancelled;
+    }
+
+    // the hook runs once when the token is cancelled, or right away if it already
+    // was. after remove() returns the hook is guaranteed not to be running.
+    inline size_t CancellationToken::on_cancel(function<void()> hook) const {
+        if (!state_) return 0;
+
+        lock_guard<mutex> guard(state_->lock);
+        if (state_->cancelled) {
+            hook();
+            return 0;
+        }
+        size_t id = ++state_->next;
+        state_->hooks.emplace(id, move(hook));
+        return id;
+    }
+
+    inline void CancellationToken::remove(size_t id) const {
+        if (!state_ || id == 0) return;
+
+        lock_guard<mutex> guard(state_->lock);
+        state_->hooks.erase(id);
+    }
+
+    // per call options. timeouts of zero keep httplib's defaults, and every
+    // timeout is capped by the time left until the deadline.
+    struct RequestOptions {
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+        chrono::milliseconds connection_timeout{0};
+        chrono::milliseconds read_timeout{0};
+        chrono::milliseconds write_timeout{0};
+        CancellationToken cancellation{nullptr};
+        // receives the response body as it arrives, e.g. for "stream": true.
+        // returning false aborts the call.
+        function<bool(const char* data, size_t length)> on_data;
+
+        bool has_deadline() const { return deadline != chrono::steady_clock::time_point::max(); }
+        bool expired() const { return chrono::steady_clock::now() >= deadline; }
+        bool interruptible() const { return has_deadline() || cancellation || on_data; }
+    };
+
+    // resolves a host once per ttl instead of once per new connection.
+    class DnsCache {
+        mutex mutex_;
+        chrono::seconds ttl_{60};
+        string address_;
+        chrono::steady_clock::time_point expiry_;
+        bool refreshing_ = false;
+
+        static string lookup(const string& host);
+
+        public:
+            void set_ttl(chrono::seconds ttl);
+            string resolve(const string& host);
+    };
+
+    inline string DnsCache::lookup(const string& host) {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || result == nullptr) {
+            return "";
+        }
+
+        char address[INET6_ADDRSTRLEN] = {};
+        const void* addr = result->ai_family == AF_INET6 ? 
+            static_cast<const void*>(&reinterpret_cast<sockaddr_in6*>(result->ai_addr)->sin6_addr) : 
+            static_cast<const void*>(&reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr);
+        bool ok = inet_ntop(result->ai_family, addr, address, sizeof(address)) != nullptr;
+        freeaddrinfo(result);
+        return ok ? address : "";
+    }
+
+    inline void DnsCache::set_ttl(chrono::seconds ttl) {
+        lock_guard<mutex> lock(mutex_);
+        ttl_ = ttl;
+        expiry_ = chrono::steady_clock::time_point();
+    }
+
+    // an empty address leaves resolution to httplib. nobody waits on a lookup:
+    // once the ttl runs out one caller refreshes the address outside the lock,
+    // while the others keep getting the stale one. a failed lookup keeps the
+    // last good address and is retried a second later.
+    inline string DnsCache::resolve(const string& host) {
+        unique_lock<mutex> lock(mutex_);
+        if (ttl_.count() <= 0) {
+            return "";
+        }
+        if (refreshing_ || chrono::steady_clock::now() < expiry_) {
+            return address_;
+        }
+
+        refreshing_ = true;
+        lock.unlock();
+        string address = lookup(host);
+        lock.lock();
+        refreshing_ = false;
+
+        bool found = !address.empty();
+        if (found) {
+            address_ = move(address);
+        }
+        expiry_ = chrono::steady_clock::now() + (found ? ttl_ : chrono::seconds(1));
+        return address_;
+    }
+
     class Session {
-        Client cli_;
+        string scheme_host_port_;
+        string host_;
+        bool verbose_;
+        string token_;
+        string proxy_host_;
+        int proxy_port_ = -1;
+        bool verify_ = true;
+
+        mutex mutex_;
+        vector<unique_ptr<Client>> clients_;
+        vector<Client*> idle_;
+        unordered_map<Client*, string> addresses_;
+
+        DnsCache dns_;
+
+        struct Warmer {
+            thread worker;
+            shared_future<size_t> done;
+        };
+
+        mutex warmers_mutex_;
+        vector<Warmer> warmers_;
+
+        class Lease {
+            Session& session_;
+            Client* cli_;
+
+            public:
+                Lease(Session& session) : 
+                    session_{session}, cli_{session.acquire()} {}
+                ~Lease() { session_.release(cli_); }
+
+                Lease(const Lease&) = delete;
+                Lease& operator=(const Lease&) = delete;
+
+                Client* operator->() const { return cli_; }
+                Client& operator*() const { return *cli_; }
+        };
+
+        // keeps the options applied to a leased client for the length of one call:
+        // the timeouts, and a cancellation hook that stops only that connection.
+        class Call {
+            Client& cli_;
+            const RequestOptions& options_;
+            size_t hook_;
+
+            public:
+                Call(Client& cli, const RequestOptions& options);
+                ~Call() { options_.cancellation.remove(hook_); }
+
+                Call(const Call&) = delete;
+                Call& operator=(const Call&) = delete;
+
+                bool alive() const { return !options_.cancellation.cancelled() && !options_.expired(); }
+                string error(Error error) const;
+        };
+
+        Client* acquire();
+        void release(Client* cli);
+        void configure(Client& cli);
+
+        session_result send(Request& req, const RequestOptions& options);
+
+        public:
+            Session(const string& scheme_host_port, bool verbose = false);
+            ~Session();
+
+            void stop();
+
+            const string& scheme_host_port() const { return scheme_host_port_; }
+            string token();
+
+            void set_token(const string& token);
+            void set_proxy(const string& host, int port);
+            void set_dns_ttl(chrono::seconds ttl);
+            void enable_server_certificate_verification(bool enabled);
+
+            shared_future<size_t> warmup(size_t connections, const string& path = "/v1/models");
+
+            session_result get(const string& path, 
+                               const RequestOptions& options = RequestOptions());
+            session_result post(const string& path, 
+                                string data, 
+                                const string& content_type = "application/json", 
+                                const RequestOptions& options = RequestOptions());
+            session_result post(const string& path, 
+                                const UploadFormDataItems& items, 
+                                const RequestOptions& options = RequestOptions());
+            session_result del(const string& path, 
+                               const RequestOptions& options = RequestOptions());
+    };
+
+    inline Session::Session(const string& scheme_host_port, bool verbose /* = false */) : 
+        scheme_host_port_{scheme_host_port}, verbose_{verbose} {
+        auto begin = scheme_host_port.find("://");
+        begin = begin == string::npos ? 0 : begin + 3;
+        auto end = scheme_host_port.find_first_of(":/", begin);
+        host_ = scheme_host_port.substr(begin, end == string::npos ? string::npos : end - begin);
+    }
+
+    inline Session::~Session() {
+        lock_guard<mutex> lock(warmers_mutex_);
+        for (auto& warmer: warmers_) {
+            warmer.worker.join();
+        }
+    }
+
+    // every concurrent call gets its own keep-alive connection; connections are
+    // returned to the pool when the call completes and reused by the next one.
+    inline Client* Session::acquire() {
+        bool proxied;
+        {
+            lock_guard<mutex> lock(mutex_);
+            proxied = proxy_port_ >= 0;
+        }
+        // resolved outside the lock, a lookup can take a while.
+        string address = proxied ? "" : dns_.resolve(host_);
+
+        lock_guard<mutex> lock(mutex_);
+        Client* cli = nullptr;
+        if (!idle_.empty()) {
+            cli = idle_.back();
+            idle_.pop_back();
+        } else {
+            clients_.emplace_back(new Client(scheme_host_port_));
+            cli = clients_.back().get();
+            configure(*cli);
+        }
+
+        string& applied = addresses_[cli];
+        if (applied != address) {
+            cli->set_hostname_addr_map(address.empty() ? 
+                                       map<string, string>() : 
+                                       map<string, string>{{ host_, address }});
+            applied = address;
+        }
+        return cli;
+    }
+
+    // a cancelled or failed call leaves its client with the socket closed, and
+    // the next call on it reconnects, so every client can go back to the pool.
+    inline void Session::release(Client* cli) {
+        lock_guard<mutex> lock(mutex_);
+        idle_.push_back(cli);
+    }
+
+    inline void Session::configure(Client& cli) {
+        cli.set_keep_alive(true);
+        cli.enable_server_certificate_verification(verify_);
+
+        if (!token_.empty()) {
+            cli.set_bearer_token_auth(token_);
+        }
+
+        if (proxy_port_ >= 0) {
+            cli.set_proxy(proxy_host_, proxy_port_);
+        }
+
+        if (verbose_) {
+            cli.set_logger([](const Request& req, const Response& resp) {
+                cout << endl;
+                cout << req.method << " " << req.path << endl;
+                for (auto header: req.headers) {
+                    cout << header.first << ": " << header.second << endl;
+                }
+                cout << endl;
+                std::cout << req.body << std::endl;
+                cout << endl << endl;
+
+                cout << resp.status << " " << resp.reason << endl;
+                for (auto header: resp.headers) {
+                    cout << header.first << ": " << header.second << endl;
+                }
+                cout << endl;
+                std::cout << resp.body << std::endl;
+                cout << endl << endl;
+            });
+        }
+    }
+
+    inline Session::Call::Call(Client& cli, const RequestOptions& options) : 
+        cli_{cli}, options_{options}, hook_{0} {
+        auto remaining = chrono::duration_cast<chrono::milliseconds>(options.deadline - chrono::steady_clock::now());
+        auto bound = [&](chrono::milliseconds timeout, time_t fallback) {
+            chrono::milliseconds value = timeout.count() > 0 ? timeout : chrono::seconds(fallback);
+            if (options.has_deadline()) {
+                value = max(chrono::milliseconds(1), min(value, remaining));
+            }
+            return value;
+        };
+
+        cli_.set_connection_timeout(bound(options.connection_timeout, CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND));
+        cli_.set_read_timeout(bound(options.read_timeout, CPPHTTPLIB_READ_TIMEOUT_SECOND));
+        cli_.set_write_timeout(bound(options.write_timeout, CPPHTTPLIB_WRITE_TIMEOUT_SECOND));
+
+        // stop() shuts down the socket once it is assigned, so it cuts a transfer
+        // short but can not abort a connect in progress.
+        Client* cli_ptr = &cli_;
+        hook_ = options.cancellation.on_cancel([cli_ptr] { cli_ptr->stop(); });
+    }
+
+    inline string Session::Call::error(Error error) const {
+        if (options_.cancellation.cancelled()) {
+            return "Canceled";
+        }
+        if (options_.expired()) {
+            return "Deadline exceeded";
+        }
+        return httplib::to_string(error);
+    }
+
+    inline void Session::stop() {
+        lock_guard<mutex> lock(mutex_);
+        for (auto& cli: clients_) {
+            cli->stop();
+        }
+    }
+    
+    inline string Session::token() {
+        lock_guard<mutex> lock(mutex_);
+        return token_;
+    }
+
+    inline void Session::set_token(const string& token) {
+        lock_guard<mutex> lock(mutex_);
+        token_ = token;
+        for (auto& cli: clients_) {
+            cli->set_bearer_token_auth(token);
+        }
+    }
+
+    inline void Session::set_proxy(const string& host, int port) {
+        lock_guard<mutex> lock(mutex_);
+        proxy_host_ = host;
+        proxy_port_ = port;
+        for (auto& cli: clients_) {
+            cli->set_proxy(host, port);
+        }
+    }
+
+    inline void Session::set_dns_ttl(chrono::seconds ttl) {
+        dns_.set_ttl(ttl);
+    }
+
+    inline void Session::enable_server_certificate_verification(bool enabled) {
+        lock_guard<mutex> lock(mutex_);
+        verify_ = enabled;
+        for (auto& cli: clients_) {
+            cli->enable_server_certificate_verification(enabled);
+        }
+    }
+
+    // opens and handshakes up to `connections` pooled connections in the
+    // background with a HEAD request each; the result is how many succeeded.
+    // the status of the HEAD does not matter, only that the connection is kept.
+    inline shared_future<size_t> Session::warmup(size_t connections, 
+                                                 const string& path /* = "/v1/models" */) {
+        auto done = make_shared<promise<size_t>>();
+        shared_future<size_t> result = done->get_future().share();
+
+        lock_guard<mutex> lock(warmers_mutex_);
+        // warmers that are done are joined here, so repeated warmups don't pile up.
+        warmers_.erase(remove_if(warmers_.begin(), warmers_.end(), [](Warmer& warmer) {
+            if (warmer.done.wait_for(chrono::seconds(0)) != future_status::ready) return false;
+            warmer.worker.join();
+            return true;
+        }), warmers_.end());
+
+        thread worker([this, connections, path, done] {
+            vector<unique_ptr<Lease>> leases;
+            for (size_t i = 0; i < connections; i++) {
+                leases.emplace_back(new Lease(*this));
+            }
+
+            atomic<size_t> warmed{0};
+            vector<thread> handshakes;
+            for (auto& lease: leases) {
+                Client* cli = &**lease;
+                handshakes.emplace_back([cli, &path, &warmed] {
+                    // a pooled client keeps the timeouts of its last call, which may
+                    // have been cut down to a nearly expired deadline.
+                    RequestOptions defaults;
+                    Call call(*cli, defaults);
+                    if (cli->Head(path).error() == Error::Success) {
+                        warmed++;
+                    }
+                });
+            }
+            for (auto& handshake: handshakes) {
+                handshake.join();
+            }
+
+            leases.clear();
+            done->set_value(warmed);
+        });
+        warmers_.push_back({ move(worker), result });
+        return result;
+    }
+
+    inline session_result Session::send(Request& req, const RequestOptions& options) {
+        if (options.cancellation.cancelled()) {
+            return make_tuple(-1, string("Canceled"));
+        }
+        if (options.expired()) {
+            return make_tuple(-1, string("Deadline exceeded"));
+        }
+
+        Lease cli(*this);
+        Call call(*cli, options);
+
+        int status = 0;
+        string body;
+        req.response_handler = [&](const Response& res) {
+            status = res.status;
+            return call.alive();
+        };
+        if (options.on_data) {
+            req.content_receiver = [&](const char* data, size_t length, uint64_t, uint64_t) {
+                if (!call.alive()) return false;
+                if (status == StatusCode::OK_200 && !options.on_data(data, length)) return false;
+                body.append(data, length);
+                return true;
+            };
+        }
+        req.upload_progress = [&](uint64_t, uint64_t) { return call.alive(); };
+        req.download_progress = [&](uint64_t, uint64_t) { return call.alive(); };
+
+        Response res;
+        Error error = Error::Success;
+        if (!cli->send(req, res, error) || error != Error::Success) {
+            return make_tuple(-1, call.error(error));
+        }
+        if (res.status != StatusCode::OK_200) {
+            return make_tuple(-1, res.reason);
+        }
+        return make_tuple(0, options.on_data ? move(body) : move(res.body));
+    }
+
+    inline session_result Session::get(const string& path, 
+                                const RequestOptions& options /* = RequestOptions() */) {
+        Request req;
+        req.method = "GET";
+        req.path = path;
+        return send(req, options);
+    }
+
+    inline session_result Session::post(const string& path, 
+                                 string data, 
+                                 const string& content_type /* = "application/json" */, 
+                                 const RequestOptions& options /* = RequestOptions() */) {
+        Request req;
+        req.method = "POST";
+        req.path = path;
+        req.body = move(data);
+        req.set_header("Content-Type", content_type);
+        return send(req, options);
+    }
+
+    inline session_result Session::post(const string& path, 
+                                 const UploadFormDataItems& items, 
+                                 const RequestOptions& options /* = RequestOptions() */) {
+        if (options.cancellation.cancelled()) {
+            return make_tuple(-1, string("Canceled"));
+        }
+        if (options.expired()) {
+            return make_tuple(-1, string("Deadline exceeded"));
+        }
+
+        Lease cli(*this);
+        Call call(*cli, options);
+
+        auto res = cli->Post(path, Headers(), items, [&](uint64_t, uint64_t) { return call.alive(); });
+        if (res.error() != Error::Success) {
+            return make_tuple(-1, call.error(res.error()));
+        }
+        if (res->status != StatusCode::OK_200) {
+            return make_tuple(-1, res->reason);
+        }
+        return make_tuple(0, move(res->body));
+    }
+
+    inline session_result Session::del(const string& path, 
+                                const RequestOptions& options /* = RequestOptions() */) {
+        Request req;
+        req.method = "DELETE";
+        req.path = path;
+        return send(req, options);
+    }
+
+    // coalesces identical concurrent calls: the first caller for a key performs
+    // the request, everyone arriving while it is in flight shares its result or
+    // exception. nothing is cached once the call completes.
+    class SingleFlight {
+        atomic<bool> enabled_{false};
+        atomic<uint64_t> calls_{0};
+        atomic<uint64_t> coalesced_{0};
+
+        mutex mutex_;
+        unordered_map<string, shared_future<json>> flights_;
+
+        public:
+            void enable(bool enabled) { enabled_ = enabled; }
+            bool enabled() const { return enabled_; }
+
+            uint64_t calls() const { return calls_; }
+            uint64_t coalesced() const { return coalesced_; }
+            size_t in_flight();
+
+            template <typename F>
+            json run(const string& key, F call);
+
+            // method, path and content type plus a sha-256 of the body, so a key
+            // costs 32 bytes however large the request is.
+            static string key(const string& method, 
+                              const string& path, 
+                              const string& content_type = "", 
+                              const string& body = "");
+    };
+
+    inline string SingleFlight::key(const string& method, 
+                                    const string& path, 
+                                    const string& content_type /* = "" */, 
+                                    const string& body /* = "" */) {
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char*>(body.data()), body.size(), digest);
+
+        string key = method + " " + path + "\n" + content_type + "\n";
+        key.append(reinterpret_cast<const char*>(digest), sizeof(digest));
+        return key;
+    }
+
+    inline size_t SingleFlight::in_flight() {
+        lock_guard<mutex> lock(mutex_);
+        return flights_.size();
+    }
+
+    template <typename F>
+    inline json SingleFlight::run(const string& key, F call) {
+        promise<json> leader;
+        shared_future<json> flight;
+        bool is_leader = false;
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto it = flights_.find(key);
+            if (it != flights_.end()) {
+                flight = it->second;
+            } else {
+                flight = leader.get_future().share();
+                flights_.emplace(key, flight);
+                is_leader = true;
+            }
+        }
+
+        if (!is_leader) {
+            coalesced_++;
+            return flight.get();
+        }
+
+        calls_++;
+        json result;
+        exception_ptr error;
+        try {
+            result = call();
+        } catch (...) {
+            error = current_exception();
+        }
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            flights_.erase(key);
+        }
+
+        if (error) {
+            leader.set_exception(error);
+        } else {
+            leader.set_value(move(result));
+        }
+        return flight.get();
+    }
+
+    // tags the calls made by the current thread for usage accounting, e.g. with
+    // a tenant or api key name, until it goes out of scope.
+    class UsageTag {
+        string previous_;
+
+        static string& current_ref() {
+            static thread_local string tag;
+            return tag;
+        }
+
+        public:
+            UsageTag(const string& tag) : 
+                previous_{current_ref()} { current_ref() = tag; }
+            ~UsageTag() { current_ref() = previous_; }
+
+            UsageTag(const UsageTag&) = delete;
+            UsageTag& operator=(const UsageTag&) = delete;
+
+            static const string& current() { return current_ref(); }
+    };
+
+    struct UsageCounters {
+        uint64_t requests = 0;
+        uint64_t prompt_tokens = 0;
+        uint64_t completion_tokens = 0;
+        uint64_t total_tokens = 0;
+    };
+
+    // aggregates the "usage" block of responses per model and usage tag. each
+    // thread writes its own shard, whose lock is only ever contended by readers;
+    // snapshot() merges the shards. budgets are checked against one atomic total.
+    class Accounting {
+        struct Shard {
+            mutex lock;
+            unordered_map<string, UsageCounters> counters;
+        };
+
+        const uint64_t id_;
+
+        mutex shards_mutex_;
+        vector<shared_ptr<Shard>> shards_;
+
+        atomic<uint64_t> total_tokens_{0};
+        atomic<uint64_t> soft_budget_{0};
+        atomic<uint64_t> hard_budget_{0};
+        atomic<int64_t> soft_delay_ms_{0};
+        atomic<bool> stream_usage_{false};
+
+        mutex export_mutex_;
+        condition_variable export_cv_;
+        bool exporting_ = false;
+        thread exporter_;
+
+        static uint64_t next_id() {
+            static atomic<uint64_t> id{0};
+            return ++id;
+        }
+
+        Shard& shard();
+
+        public:
+            Accounting() : 
+                id_{next_id()} {}
+            ~Accounting();
+
+            Accounting(const Accounting&) = delete;
+            Accounting& operator=(const Accounting&) = delete;
+
+            void record(const string& model, const json& usage);
+            uint64_t total_tokens() const { return total_tokens_; }
+
+            // a stream only reports usage when asked to. when enabled, chat streams
+            // without stream_options get {"include_usage": true}, and on_data then
+            // sees one more chunk before [DONE]: "choices" empty, "usage" set.
+            void set_stream_usage(bool enable) { stream_usage_ = enable; }
+            bool stream_usage() const { return stream_usage_; }
+
+            // zero disables a budget. past the soft budget every new request waits
+            // `delay` before it is sent; past the hard budget it is rejected.
+            void set_budget(uint64_t soft, uint64_t hard, chrono::milliseconds delay = chrono::milliseconds(1000));
+            void admit() const;
+
+            json snapshot();
+            void reset();
+
+            // calls sink with a snapshot every interval on a background thread.
+            void export_every(chrono::milliseconds interval, function<void(const json&)> sink);
+            void stop_export();
+    };
+
+    inline Accounting::~Accounting() {
+        stop_export();
+    }
+
+    inline Accounting::Shard& Accounting::shard() {
+        // keyed by id rather than address, so a new instance at a recycled address
+        // never picks up a shard of a destroyed one. the instance owns its shards;
+        // entries left by destroyed instances expire and are pruned on insert.
+        struct Entry {
+            Shard* shard;
+            weak_ptr<Shard> owner;
+        };
+        static thread_local unordered_map<uint64_t, Entry> shards;
+
+        auto it = shards.find(id_);
+        if (it != shards.end()) {
+            return *it->second.shard;
+        }
+
+        for (auto entry = shards.begin(); entry != shards.end(); ) {
+            entry = entry->second.owner.expired() ? shards.erase(entry) : next(entry);
+        }
+        auto local = make_shared<Shard>();
+        {
+            lock_guard<mutex> lock(shards_mutex_);
+            shards_.push_back(local);
+        }
+        shards[id_] = { local.get(), local };
+        return *local;
+    }
+
+    inline void Accounting::record(const string& model, const json& usage) {
+        uint64_t prompt = usage.value("prompt_tokens", uint64_t(0));
+        uint64_t completion = usage.value("completion_tokens", uint64_t(0));
+        uint64_t total = usage.value("total_tokens", prompt + completion);
+
+        Shard& local = shard();
+        {
+            lock_guard<mutex> lock(local.lock);
+            UsageCounters& counters = local.counters[model + '\n' + UsageTag::current()];
+            counters.requests++;
+            counters.prompt_tokens += prompt;
+            counters.completion_tokens += completion;
+            counters.total_tokens += total;
+        }
+        total_tokens_.fetch_add(total, memory_order_relaxed);
+    }
+
+    inline void Accounting::set_budget(uint64_t soft, 
+                                       uint64_t hard, 
+                                       chrono::milliseconds delay /* = chrono::milliseconds(1000) */) {
+        soft_budget_ = soft;
+        hard_budget_ = hard;
+        soft_delay_ms_ = delay.count();
+    }
+
+    inline void Accounting::admit() const {
+        uint64_t total = total_tokens_.load(memory_order_relaxed);
+
+        uint64_t hard = hard_budget_.load(memory_order_relaxed);
+        if (hard > 0 && total >= hard) {
+            throw runtime_error("token budget exhausted: " + to_string(total) + " of " + to_string(hard));
+        }
+
+        uint64_t soft = soft_budget_.load(memory_order_relaxed);
+        if (soft > 0 && total >= soft) {
+            this_thread::sleep_for(chrono::milliseconds(soft_delay_ms_.load(memory_order_relaxed)));
+        }
+    }
+
+    inline json Accounting::snapshot() {
+        map<string, UsageCounters> merged;
+        {
+            lock_guard<mutex> lock(shards_mutex_);
+            for (auto& shard: shards_) {
+                lock_guard<mutex> shard_lock(shard->lock);
+                for (auto& entry: shard->counters) {
+                    UsageCounters& counters = merged[entry.first];
+                    counters.requests += entry.second.requests;
+                    counters.prompt_tokens += entry.second.prompt_tokens;
+                    counters.completion_tokens += entry.second.completion_tokens;
+                    counters.total_tokens += entry.second.total_tokens;
+                }
+            }
+        }
+
+        json usage = json::array();
+        for (auto& entry: merged) {
+            size_t n = entry.first.find('\n');
+            usage.push_back({
+                { "model", entry.first.substr(0, n) },
+                { "tag", entry.first.substr(n + 1) },
+                { "requests", entry.second.requests },
+                { "prompt_tokens", entry.second.prompt_tokens },
+                { "completion_tokens", entry.second.completion_tokens },
+                { "total_tokens", entry.second.total_tokens }
+            });
+        }
+        return {{ "total_tokens", total_tokens() }, { "usage", usage }};
+    }
+
+    inline void Accounting::reset() {
+        lock_guard<mutex> lock(shards_mutex_);
+        for (auto& shard: shards_) {
+            lock_guard<mutex> shard_lock(shard->lock);
+            shard->counters.clear();
+        }
+        total_tokens_ = 0;
+    }
+
+    inline void Accounting::export_every(chrono::milliseconds interval, function<void(const json&)> sink) {
+        stop_export();
+
+        lock_guard<mutex> lock(export_mutex_);
+        exporting_ = true;
+        exporter_ = thread([this, interval, sink] {
+            unique_lock<mutex> lock(export_mutex_);
+            while (!export_cv_.wait_for(lock, interval, [this] { return !exporting_; })) {
+                lock.unlock();
+                sink(snapshot());
+                lock.lock();
+            }
+        });
+    }
+
+    inline void Accounting::stop_export() {
+        {
+            lock_guard<mutex> lock(export_mutex_);
+            exporting_ = false;
+        }
+        export_cv_.notify_all();
+        if (exporter_.joinable()) {
+            exporter_.join();
+        }
+    }
+
+    class OpenAI;
+
+    inline string file_content(const string& path) {
+        ifstream is(path, ios::binary);
+        ostringstream oss;
+        oss << is.rdbuf();
+        return oss.str();
+    }
+
+    class CategoryAudio {
+        OpenAI& openai_;
+
+        public:
+            CategoryAudio(OpenAI& openai) : 
+                openai_{openai} {}
+            
+            string speech(const json& request, const RequestOptions& options = RequestOptions());
+            json transcription(const json& request, const RequestOptions& options = RequestOptions());
+            json translation(const json& request, const RequestOptions& options = RequestOptions());
+
+            static UploadFormDataItems transcription_items(const json& request);
+            static UploadFormDataItems translation_items(const json& request);
+    };
+
+    // thrown by CategoryChat::create_gated when the input is flagged or cannot
+    // be moderated. verdict() is the /v1/moderations response, or
+    // {"error": {"message": ...}} when the moderation call itself failed.
+    class ModerationError : public runtime_error {
+        json verdict_;
+
+        public:
+            ModerationError(const string& message, json verdict) : 
+                runtime_error{message}, verdict_{move(verdict)} {}
+
+            const json& verdict() const { return verdict_; }
+            bool flagged() const { return verdict_.contains("results"); }
+    };
+
+    class CategoryChat {
+        OpenAI& openai_;
+
+        public:
+            CategoryChat(OpenAI& openai) : 
+                openai_{openai} {}
+
+            json create(const json& request, const RequestOptions& options = RequestOptions());
+            // runs /v1/moderations on the user messages alongside the completion.
+            // nothing reaches the caller, on_data included, until moderation passes;
+            // flagged input cancels the completion and throws ModerationError, and
+            // so does a moderation call that fails. both calls carry the caller's
+            // UsageTag.
+            json create_gated(const json& request, 
+                              const RequestOptions& options = RequestOptions(), 
+                              const json& moderation = json::object());
+
+        private:
+            static json moderation_input(const json& request);
+    };
+
+    class CategoryEmbedding {
+        OpenAI& openai_;
+
+        public:
+            CategoryEmbedding(OpenAI& openai) : 
+                openai_{openai} {}
+            
+            json create(const json& request, const RequestOptions& options = RequestOptions());
+    };
+
+    class CategoryFinetunning {
+        OpenAI& openai_;
+
+        public:
+            CategoryFinetunning(OpenAI& openai) : 
+                openai_{openai} {}
+
+            json create(const json& request, const RequestOptions& options = RequestOptions());
+            json list(const RequestOptions& options = RequestOptions());
+            json events(const string& fine_tuning_job_id, const RequestOptions& options = RequestOptions());
+            json checkpoints(const string& fine_tuning_job_id, const RequestOptions& options = RequestOptions());
+            json retrieve(const string& fine_tuning_job_id, const RequestOptions& options = RequestOptions());
+            json cancel(const string& fine_tuning_job_id, const RequestOptions& options = RequestOptions());
+    };
+
+    class CategoryFiles {
+        OpenAI& openai_;
+
+        public:
+            CategoryFiles(OpenAI& openai) : 
+                openai_{openai} {}
+
+            json upload(const json& request, const RequestOptions& options = RequestOptions());
+            json list(const RequestOptions& options = RequestOptions());
+            json retrieve(const string& file_id, const RequestOptions& options = RequestOptions());
+            json del(const string& file_id, const RequestOptions& options = RequestOptions());
+            json content(const string& file_id, const RequestOptions& options = RequestOptions());
+
+            static UploadFormDataItems upload_items(const json& request);
+    };
+
+    class CategoryImages {
+        OpenAI& openai_;
+
+        public:
+            CategoryImages(OpenAI& openai) : 
+                openai_{openai} {}
+
+            json create(const json& request, const RequestOptions& options = RequestOptions());
+            json edit(const json& request, const RequestOptions& options = RequestOptions());
+            json variation(const json& request, const RequestOptions& options = RequestOptions());
+
+            static UploadFormDataItems edit_items(const json& request);
+            static UploadFormDataItems variation_items(const json& request);
+    };
+
+    class CategoryModels {
+        OpenAI& openai_;
+
+        public:
+            CategoryModels(OpenAI& openai) : 
+                openai_{openai} {}
+
+            json list(const RequestOptions& options = RequestOptions());
+            json retrieve(const string& model, const RequestOptions& options = RequestOptions());
+            json del(const string& model, const RequestOptions& options = RequestOptions());
+    };
+
+    class CategoryModerations {
+        OpenAI& openai_;
+
+        public:
+            CategoryModerations(OpenAI& openai) : 
+                openai_{openai} {}
+
+            json create(const json& request, const RequestOptions& options = RequestOptions());
+    };
+
+    class ThreadPool {
+        mutex mutex_;
+        condition_variable cv_;
+        deque<function<void()>> tasks_;
+        vector<thread> workers_;
+        bool stopping_ = false;
+
+        public:
+            ThreadPool(size_t threads = 0);
+            ~ThreadPool();
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            template <typename F>
+            future<invoke_result_t<F>> submit(F f);
+    };
+
+    inline ThreadPool::ThreadPool(size_t threads /* = 0 */) {
+        if (threads == 0) {
+            threads = max(1u, thread::hardware_concurrency());
+        }
+
+        for (size_t i = 0; i < threads; i++) {
+            workers_.emplace_back([this] {
+                for (;;) {
+                    function<void()> task;
+                    {
+                        unique_lock<mutex> lock(mutex_);
+                        cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                        if (tasks_.empty()) return;
+                        task = move(tasks_.front());
+                        tasks_.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    inline ThreadPool::~ThreadPool() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker: workers_) {
+            worker.join();
+        }
+    }
+
+    template <typename F>
+    inline future<invoke_result_t<F>> ThreadPool::submit(F f) {
+        using result_type = invoke_result_t<F>;
+
+        auto task = make_shared<packaged_task<result_type()>>(move(f));
+        future<result_type> result = task->get_future();
+        {
+            lock_guard<mutex> lock(mutex_);
+            tasks_.emplace_back([task] { (*task)(); });
+        }
+        cv_.notify_one();
+        return result;
+    }
+
+    // drives a chat completion through its tool calls: registered callables are
+    // advertised in "tools", every round's tool_calls run concurrently on the
+    // pool, and their results are appended in call order before asking again.
+    class ToolRunner {
+        struct Tool {
+            json definition;
+            function<json(const json& arguments)> call;
+        };
+
+        OpenAI& openai_;
+        map<string, Tool> tools_;
+        size_t max_rounds_ = 8;
+        ThreadPool pool_;
+
+        json invoke(const json& tool_call) const;
+
+        public:
+            ToolRunner(OpenAI& openai, size_t threads = 0) : 
+                openai_{openai}, pool_{threads} {}
+
+            ToolRunner& add(const string& name, 
+                            const string& description, 
+                            const json& parameters, 
+                            function<json(const json& arguments)> call);
+            void set_max_rounds(size_t max_rounds) { max_rounds_ = max_rounds; }
+
+            // appends every assistant and tool message to request["messages"] and
+            // returns the first completion that asks for no more tools. registered
+            // tools are added to any the request already declares; streaming is
+            // rejected.
+            json run(json& request, const RequestOptions& options = RequestOptions());
+    };
+
+    // a lock-free single producer, single consumer queue. capacity is rounded
+    // up to a power of two; write() and read() move as many items as fit.
+    template <typename T>
+    class RingBuffer {
+        vector<T> buffer_;
+        size_t mask_;
+        alignas(64) atomic<uint64_t> head_{0};
+        alignas(64) atomic<uint64_t> tail_{0};
+
+        public:
+            RingBuffer(size_t capacity);
+
+            size_t write(const T* data, size_t count);
+            size_t read(T* data, size_t count);
+
+            size_t size() const { return head_.load(memory_order_acquire) - tail_.load(memory_order_acquire); }
+            size_t capacity() const { return buffer_.size(); }
+            // total items ever written, used to order events after the audio before them.
+            uint64_t written() const { return head_.load(memory_order_acquire); }
+            uint64_t consumed() const { return tail_.load(memory_order_acquire); }
+    };
+
+    template <typename T>
+    inline RingBuffer<T>::RingBuffer(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    template <typename T>
+    inline size_t RingBuffer<T>::write(const T* data, size_t count) {
+        uint64_t head = head_.load(memory_order_relaxed);
+        uint64_t tail = tail_.load(memory_order_acquire);
+        count = min<size_t>(count, buffer_.size() - (head - tail));
+        for (size_t i = 0; i < count; i++) {
+            buffer_[(head + i) & mask_] = data[i];
+        }
+        head_.store(head + count, memory_order_release);
+        return count;
+    }
+
+    template <typename T>
+    inline size_t RingBuffer<T>::read(T* data, size_t count) {
+        uint64_t tail = tail_.load(memory_order_relaxed);
+        uint64_t head = head_.load(memory_order_acquire);
+        count = min<size_t>(count, head - tail);
+        for (size_t i = 0; i < count; i++) {
+            data[i] = buffer_[(tail + i) & mask_];
+        }
+        tail_.store(tail + count, memory_order_release);
+        return count;
+    }
+
+    inline string base64_encode(const char* data, size_t length) {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        string out;
+        out.reserve((length + 2) / 3 * 4);
+        size_t i = 0;
+        for (; i + 2 < length; i += 3) {
+            uint32_t n = (uint8_t(data[i]) << 16) | (uint8_t(data[i + 1]) << 8) | uint8_t(data[i + 2]);
+            out += table[(n >> 18) & 63];
+            out += table[(n >> 12) & 63];
+            out += table[(n >> 6) & 63];
+            out += table[n & 63];
+        }
+        if (i < length) {
+            uint32_t n = uint8_t(data[i]) << 16;
+            if (i + 1 < length) n |= uint8_t(data[i + 1]) << 8;
+            out += table[(n >> 18) & 63];
+            out += table[(n >> 12) & 63];
+            out += i + 1 < length ? table[(n >> 6) & 63] : '=';
+            out += '=';
+        }
+        return out;
+    }
+
+    inline string base64_decode(const string& in) {
+        static const auto table = [] {
+            array<int8_t, 256> t;
+            t.fill(-1);
+            const char* chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            for (int i = 0; i < 64; i++) t[uint8_t(chars[i])] = int8_t(i);
+            return t;
+        }();
+
+        string out;
+        out.reserve(in.size() / 4 * 3);
+        uint32_t bits = 0;
+        int count = 0;
+        for (char c: in) {
+            int8_t v = table[uint8_t(c)];
+            if (v < 0) continue;
+            bits = (bits << 6) | uint32_t(v);
+            count += 6;
+            if (count >= 8) {
+                count -= 8;
+                out += char((bits >> count) & 0xff);
+            }
+        }
+        return out;
+    }
+
+    // the client side of RFC 6455 over a plain or TLS socket. the socket is
+    // non-blocking once connected, and every read and write must come from one
+    // thread, as an SSL object can not be read and written concurrently.
+    class WebSocket {
+        int fd_ = -1;
+        SSL_CTX* ctx_ = nullptr;
+        SSL* ssl_ = nullptr;
+
+        string input_;
+        string message_;
+        int message_opcode_ = 0;
+
+        void wait(short events, int timeout_ms) const;
+        void write_all(const char* data, size_t length);
+        int write_some(const char* data, size_t length);
+
+        public:
+            enum Opcode { continuation = 0x0, text = 0x1, binary = 0x2, close = 0x8, ping = 0x9, pong = 0xa };
+
+            WebSocket() = default;
+            ~WebSocket();
+
+            WebSocket(const WebSocket&) = delete;
+            WebSocket& operator=(const WebSocket&) = delete;
+
+            void connect(const string& url, const Headers& headers, chrono::milliseconds timeout);
+            void shutdown();
+
+            int fd() const { return fd_; }
+            bool pending() const { return ssl_ && SSL_pending(ssl_) > 0; }
+
+            void send(int opcode, const char* data, size_t length);
+
+            // reads whatever is available without blocking; false once the peer
+            // has closed the connection.
+            bool receive();
+            // pops the next complete message, reassembling fragments. control
+            // frames are returned as they arrive.
+            bool next(int& opcode, string& payload);
+    };
+
+    inline WebSocket::~WebSocket() {
+        shutdown();
+    }
+
+    inline void WebSocket::shutdown() {
+        if (ssl_) {
+            SSL_shutdown(ssl_);
+            SSL_free(ssl_);
+            ssl_ = nullptr;
+        }
+        if (ctx_) {
+            SSL_CTX_free(ctx_);
+            ctx_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    inline void WebSocket::wait(short events, int timeout_ms) const {
+        pollfd pfd = { fd_, events, 0 };
+        ::poll(&pfd, 1, timeout_ms);
+    }
+
+    // returns bytes written, 0 when the socket would block, -1 on error.
+    inline int WebSocket::write_some(const char* data, size_t length) {
+        if (ssl_) {
+            int n = SSL_write(ssl_, data, int(length));
+            if (n > 0) return n;
+            int error = SSL_get_error(ssl_, n);
+            if (error == SSL_ERROR_WANT_WRITE) { wait(POLLOUT, 100); return 0; }
+            if (error == SSL_ERROR_WANT_READ) { wait(POLLIN, 100); return 0; }
+            return -1;
+        }
+
+#ifdef MSG_NOSIGNAL
+        ssize_t n = ::send(fd_, data, length, MSG_NOSIGNAL);
+#else
+        // SO_NOSIGPIPE is set on the socket instead.
+        ssize_t n = ::send(fd_, data, length, 0);
+#endif
+        if (n >= 0) return int(n);
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) { wait(POLLOUT, 100); return 0; }
+        return -1;
+    }
+
+    inline void WebSocket::write_all(const char* data, size_t length) {
+        while (length > 0) {
+            int n = write_some(data, length);
+            if (n < 0) {
+                throw runtime_error("websocket write failed");
+            }
+            data += n;
+            length -= size_t(n);
+        }
+    }
+
+    inline void WebSocket::connect(const string& url, const Headers& headers, chrono::milliseconds timeout) {
+        bool secure;
+        size_t begin;
+        if (url.compare(0, 6, "wss://") == 0) {
+            secure = true;
+            begin = 6;
+        } else if (url.compare(0, 5, "ws://") == 0) {
+            secure = false;
+            begin = 5;
+        } else {
+            throw runtime_error("unsupported websocket url: " + url);
+        }
+
+        size_t slash = url.find('/', begin);
+        string authority = url.substr(begin, slash == string::npos ? string::npos : slash - begin);
+        string path = slash == string::npos ? "/" : url.substr(slash);
+        string host = authority;
+        string port = secure ? "443" : "80";
+        size_t colon = authority.rfind(':');
+        if (colon != string::npos) {
+            host = authority.substr(0, colon);
+            port = authority.substr(colon + 1);
+        }
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+            throw runtime_error("can not resolve " + host);
+        }
+
+        for (addrinfo* a = addresses; a != nullptr && fd_ < 0; a = a->ai_next) {
+            int fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) continue;
+
+            timeval tv;
+            tv.tv_sec = timeout.count() / 1000;
+            tv.tv_usec = (timeout.count() % 1000) * 1000;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+            if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                fd_ = fd;
+            } else {
+                ::close(fd);
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd_ < 0) {
+            throw runtime_error("can not connect to " + authority);
+        }
+
+        // small frames of audio must not wait for Nagle's algorithm.
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        // a peer that went away must not kill the process with SIGPIPE where send()
+        // has no MSG_NOSIGNAL, e.g. on macOS; this also covers writes from TLS.
+        setsockopt(fd_, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        if (secure) {
+            ctx_ = SSL_CTX_new(TLS_client_method());
+            SSL_CTX_set_default_verify_paths(ctx_);
+            SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+            ssl_ = SSL_new(ctx_);
+            SSL_set_fd(ssl_, fd_);
+            SSL_set_tlsext_host_name(ssl_, host.c_str());
+            SSL_set1_host(ssl_, host.c_str());
+            SSL_set_mode(ssl_, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            if (SSL_connect(ssl_) != 1) {
+                shutdown();
+                throw runtime_error("tls handshake with " + authority + " failed");
+            }
+        }
+
+        unsigned char nonce[16];
+        RAND_bytes(nonce, sizeof(nonce));
+        string key = base64_encode(reinterpret_cast<const char*>(nonce), sizeof(nonce));
+
+        string request = "GET " + path + " HTTP/1.1\r\n"
+                         "Host: " + authority + "\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Key: " + key + "\r\n"
+                         "Sec-WebSocket-Version: 13\r\n";
+        for (const auto& header: headers) {
+            request += header.first + ": " + header.second + "\r\n";
+        }
+        request += "\r\n";
+        write_all(request.data(), request.size());
+
+        string response;
+        size_t end;
+        while ((end = response.find("\r\n\r\n")) == string::npos) {
+            char buffer[4096];
+            int n = ssl_ ? SSL_read(ssl_, buffer, sizeof(buffer)) : int(::recv(fd_, buffer, sizeof(buffer), 0));
+            if (n <= 0) {
+                shutdown();
+                throw runtime_error("websocket handshake with " + authority + " failed");
+            }
+            response.append(buffer, size_t(n));
+        }
+        input_ = response.substr(end + 4);
+        response.resize(end);
+
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        string accept = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        SHA1(reinterpret_cast<const unsigned char*>(accept.data()), accept.size(), digest);
+        accept = base64_encode(reinterpret_cast<const char*>(digest), sizeof(digest));
+
+        if (response.compare(0, 12, "HTTP/1.1 101") != 0 || response.find(accept) == string::npos) {
+            shutdown();
+            throw runtime_error("websocket upgrade refused: " + response.substr(0, response.find("\r\n")));
+        }
+
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    inline void WebSocket::send(int opcode, const char* data, size_t length) {
+        string frame;
+        frame.reserve(length + 14);
+        frame += char(0x80 | opcode);
+        if (length < 126) {
+            frame += char(0x80 | length);
+        } else if (length <= 0xffff) {
+            frame += char(0x80 | 126);
+            frame += char((length >> 8) & 0xff);
+            frame += char(length & 0xff);
+        } else {
+            frame += char(0x80 | 127);
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                frame += char((uint64_t(length) >> shift) & 0xff);
+            }
+        }
+
+        unsigned char mask[4];
+        RAND_bytes(mask, sizeof(mask));
+        frame.append(reinterpret_cast<const char*>(mask), sizeof(mask));
+        size_t offset = frame.size();
+        frame.append(data, length);
+        for (size_t i = 0; i < length; i++) {
+            frame[offset + i] ^= char(mask[i & 3]);
+        }
+
+        write_all(frame.data(), frame.size());
+    }
+
+    inline bool WebSocket::receive() {
+        char buffer[16384];
+        for (;;) {
+            if (ssl_) {
+                int n = SSL_read(ssl_, buffer, sizeof(buffer));
+                if (n > 0) {
+                    input_.append(buffer, size_t(n));
+                    continue;
+                }
+                int error = SSL_get_error(ssl_, n);
+                return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+            }
+
+            ssize_t n = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                input_.append(buffer, size_t(n));
+                continue;
+            }
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        }
+    }
+
+    inline bool WebSocket::next(int& opcode, string& payload) {
+        for (;;) {
+            if (input_.size() < 2) return false;
+
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(input_.data());
+            bool fin = p[0] & 0x80;
+            int op = p[0] & 0x0f;
+            bool masked = p[1] & 0x80;
+            uint64_t length = p[1] & 0x7f;
+            size_t header = 2;
+            if (length == 126) {
+                if (input_.size() < 4) return false;
+                length = (uint64_t(p[2]) << 8) | p[3];
+                header = 4;
+            } else if (length == 127) {
+                if (input_.size() < 10) return false;
+                length = 0;
+                for (int i = 0; i < 8; i++) length = (length << 8) | p[2 + i];
+                header = 10;
+            }
+            size_t key = header;
+            if (masked) header += 4;
+            if (input_.size() < header + length) return false;
+
+            string data = input_.substr(header, size_t(length));
+            if (masked) {
+                for (size_t i = 0; i < data.size(); i++) data[i] ^= input_[key + (i & 3)];
+            }
+            input_.erase(0, header + size_t(length));
+
+            if (op >= close) {
+                opcode = op;
+                payload = move(data);
+                return true;
+            }
+
+            if (op != continuation) {
+                message_opcode_ = op;
+                message_.clear();
+            }
+            message_ += data;
+            if (fin) {
+                opcode = message_opcode_;
+                payload = move(message_);
+                message_.clear();
+                return true;
+            }
+        }
+    }
+
+    // one realtime conversation over a websocket. a single thread owns the
+    // socket: it receives and dispatches events, and sends queued events and
+    // microphone audio. audio moves through lock-free rings of pcm16 samples,
+    // so the audio callbacks of the caller never block on the network.
+    class RealtimeSession {
+        struct Outgoing {
+            string text;
+            uint64_t audio_mark;
+        };
+
+        WebSocket ws_;
+        RingBuffer<int16_t> input_audio_;
+        RingBuffer<int16_t> output_audio_;
+        atomic<uint64_t> dropped_samples_{0};
+
+        mutex outgoing_mutex_;
+        deque<Outgoing> outgoing_;
+        int wakeup_[2] = { -1, -1 };
+
+        shared_mutex handlers_mutex_;
+        unordered_map<string, vector<function<void(const json&)>>> handlers_;
+
+        atomic<bool> running_{false};
+        thread loop_;
+
+        void run();
+        void send_audio(uint64_t until);
+        void dispatch(const json& event);
 
         public:
-            Session(const string& scheme_host_port, bool verbose = false);
+            RealtimeSession(size_t audio_capacity = 1 << 18);
+            ~RealtimeSession();
 
-            void stop();
+            RealtimeSession(const RealtimeSession&) = delete;
+            RealtimeSession& operator=(const RealtimeSession&) = delete;
 
-            void set_token(const string& token);
-            void set_proxy(const string& host, int port);
+            void open(const string& url, const Headers& headers, chrono::milliseconds timeout);
+            void close();
+            bool running() const { return running_; }
 
-            session_result get(const string& path);
-            session_result post(const string& path, 
-                                const string& data, 
-                                const string& content_type = "application/json");
-            session_result post(const string& path, 
-                                const UploadFormDataItems& items);
-            session_result del(const string& path);                
+            // handlers run on the session thread; "*" receives every event.
+            void on(const string& type, function<void(const json&)> handler);
+
+            // thread safe; events are sent in order, after the audio written before them.
+            void send(const json& event);
+
+            size_t write_audio(const int16_t* samples, size_t count);
+            size_t read_audio(int16_t* samples, size_t count);
+            size_t audio_available() const { return output_audio_.size(); }
+            uint64_t dropped_samples() const { return dropped_samples_; }
+
+            void update(const json& session);
+            void commit_audio();
+            void clear_audio();
+            void create_response(const json& response = json::object());
+            void cancel_response();
     };
 
-    inline Session::Session(const string& scheme_host_port, bool verbose /* = false */) : 
-        cli_{scheme_host_port} {
-        if (verbose) {
-            cli_.set_logger([](const Request& req, const Response& resp) {
-                cout << endl;
-                cout << req.method << " " << req.path << endl;
-                for (auto header: req.headers) {
-                    cout << header.first << ": " << header.second << endl;
-                }
-                cout << endl;
-                std::cout << req.body << std::endl;
-                cout << endl << endl;
+    inline RealtimeSession::RealtimeSession(size_t audio_capacity /* = 1 << 18 */) : 
+        input_audio_{audio_capacity}, output_audio_{audio_capacity} {}
 
-                cout << resp.status << " " << resp.reason << endl;
-                for (auto header: resp.headers) {
-                    cout << header.first << ": " << header.second << endl;
-                }
-                cout << endl;
-                std::cout << resp.body << std::endl;
-                cout << endl << endl;
-            });
-        }
+    inline RealtimeSession::~RealtimeSession() {
+        close();
     }
 
-    inline void Session::stop() {
-        cli_.stop();
-    }
-    
-    inline void Session::set_token(const string& token) {
-        cli_.set_bearer_token_auth(token);
-    }
+    inline void RealtimeSession::open(const string& url, const Headers& headers, chrono::milliseconds timeout) {
+        ws_.connect(url, headers, timeout);
 
-    inline void Session::set_proxy(const string& host, int port) {
-        cli_.set_proxy(host, port);
+        if (pipe(wakeup_) != 0) {
+            ws_.shutdown();
+            throw runtime_error("can not create the realtime wakeup pipe");
+        }
+        fcntl(wakeup_[0], F_SETFL, fcntl(wakeup_[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wakeup_[1], F_SETFL, fcntl(wakeup_[1], F_GETFL, 0) | O_NONBLOCK);
+
+        running_ = true;
+        loop_ = thread([this] { run(); });
     }
 
-    inline session_result Session::get(const string& path) {
-        auto res = cli_.Get(path);
-        if (res.error() != Error::Success) {
-            return make_tuple(-1, httplib::to_string(res.error()));
+    inline void RealtimeSession::close() {
+        if (loop_.joinable()) {
+            running_ = false;
+            if (wakeup_[1] >= 0) {
+                char c = 0;
+                (void)!::write(wakeup_[1], &c, 1);
+            }
+            loop_.join();
         }
-        if (res->status != StatusCode::OK_200) {
-            return make_tuple(-1, res->reason);
+        for (int& fd: wakeup_) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
         }
-        return make_tuple(0, res->body);
+        ws_.shutdown();
     }
 
-    inline session_result Session::post(const string& path, 
-                                 const string& data, 
-                                 const string& content_type /* = "application/json" */) {
-        auto res = cli_.Post(path, data, content_type);
-        if (res.error() != Error::Success) {
-            return make_tuple(-1, httplib::to_string(res.error()));
-        }
-        if (res->status != StatusCode::OK_200) {
-            return make_tuple(-1, res->reason);
-        }
-        return make_tuple(0, res->body);
+    inline void RealtimeSession::on(const string& type, function<void(const json&)> handler) {
+        unique_lock<shared_mutex> lock(handlers_mutex_);
+        handlers_[type].push_back(move(handler));
     }
 
-    inline session_result Session::post(const string& path, 
-                                 const UploadFormDataItems& items) {
-        auto res = cli_.Post(path, items);
-        if (res.error() != Error::Success) {
-            return make_tuple(-1, httplib::to_string(res.error()));
+    // handlers are copied out before they run, so a handler may call on().
+    inline void RealtimeSession::dispatch(const json& event) {
+        vector<function<void(const json&)>> handlers;
+        {
+            shared_lock<shared_mutex> lock(handlers_mutex_);
+            for (const string& type: { event.value("type", ""), string("*") }) {
+                auto it = handlers_.find(type);
+                if (it != handlers_.end()) {
+                    handlers.insert(handlers.end(), it->second.begin(), it->second.end());
+                }
+            }
         }
-        if (res->status != StatusCode::OK_200) {
-            return make_tuple(-1, res->reason);
+        for (auto& handler: handlers) {
+            handler(event);
         }
-        return make_tuple(0, res->body);
     }
 
-    inline session_result Session::del(const string& path) {
-        auto res = cli_.Delete(path);
-        if (res.error() != Error::Success) {
-            return make_tuple(-1, httplib::to_string(res.error()));
-        }
-        if (res->status != StatusCode::OK_200) {
-            return make_tuple(-1, res->reason);
+    inline void RealtimeSession::send(const json& event) {
+        {
+            lock_guard<mutex> lock(outgoing_mutex_);
+            outgoing_.push_back({ event.dump(), input_audio_.written() });
         }
-        return make_tuple(0, res->body);
+        char c = 0;
+        (void)!::write(wakeup_[1], &c, 1);
     }
 
-    class OpenAI;
-
-    inline string file_content(const string& path) {
-        ifstream is(path, ios::binary);
-        ostringstream oss;
-        oss << is.rdbuf();
-        return oss.str();
+    inline size_t RealtimeSession::write_audio(const int16_t* samples, size_t count) {
+        return input_audio_.write(samples, count);
     }
 
-    class CategoryAudio {
-        OpenAI& openai_;
-
-        public:
-            CategoryAudio(OpenAI& openai) : 
-                openai_{openai} {}
-            
-            string speech(json request);
-            json transcription(json request);
-            json translation(json request);
-    };
-
-    class CategoryChat {
-        OpenAI& openai_;
-
-        public:
-            CategoryChat(OpenAI& openai) : 
-                openai_{openai} {}
-
-            json create(json request);
-    };
-
-    class CategoryEmbedding {
-        OpenAI& openai_;
-
-        public:
-            CategoryEmbedding(OpenAI& openai) : 
-                openai_{openai} {}
-            
-            json create(json request);
-    };
-
-    class CategoryFinetunning {
-        OpenAI& openai_;
-
-        public:
-            CategoryFinetunning(OpenAI& openai) : 
-                openai_{openai} {}
+    inline size_t RealtimeSession::read_audio(int16_t* samples, size_t count) {
+        return output_audio_.read(samples, count);
+    }
 
-            json create(json request);
-            json list();
-            json events(const string& fine_tuning_job_id);
-            json checkpoints(const string& fine_tuning_job_id);
-            json retrieve(const string& fine_tuning_job_id);
-            json cancel(const string& fine_tuning_job_id);
-    };
+    inline void RealtimeSession::update(const json& session) {
+        send({{ "type", "session.update" }, { "session", session }});
+    }
 
-    class CategoryFiles {
-        OpenAI& openai_;
+    inline void RealtimeSession::commit_audio() {
+        send({{ "type", "input_audio_buffer.commit" }});
+    }
 
-        public:
-            CategoryFiles(OpenAI& openai) : 
-                openai_{openai} {}
+    inline void RealtimeSession::clear_audio() {
+        send({{ "type", "input_audio_buffer.clear" }});
+    }
 
-            json upload(json request);
-            json list();
-            json retrieve(const string& file_id);
-            json del(const string& file_id);
-            json content(const string& file_id);
-    };
+    inline void RealtimeSession::create_response(const json& response /* = json::object() */) {
+        send({{ "type", "response.create" }, { "response", response }});
+    }
 
-    class CategoryImages {
-        OpenAI& openai_;
+    inline void RealtimeSession::cancel_response() {
+        send({{ "type", "response.cancel" }});
+    }
 
-        public:
-            CategoryImages(OpenAI& openai) : 
-                openai_{openai} {}
+    // sends the microphone audio written before `until` in chunks of 100 ms at 24 kHz.
+    inline void RealtimeSession::send_audio(uint64_t until) {
+        int16_t chunk[2400];
+        while (input_audio_.consumed() < until) {
+            size_t n = input_audio_.read(chunk, min<uint64_t>(2400, until - input_audio_.consumed()));
+            if (n == 0) break;
+
+            json event = {
+                { "type", "input_audio_buffer.append" },
+                { "audio", base64_encode(reinterpret_cast<const char*>(chunk), n * sizeof(int16_t)) }
+            };
+            string text = event.dump();
+            ws_.send(WebSocket::text, text.data(), text.size());
+        }
+    }
 
-            json create(json request);
-            json edit(json request);
-            json variation(json request);
-    };
+    inline void RealtimeSession::run() {
+        deque<Outgoing> outgoing;
+        try {
+            while (running_) {
+                if (!ws_.pending()) {
+                    // wakes up for incoming frames, queued events, or every 10 ms to pick
+                    // up microphone audio without a syscall per audio callback.
+                    pollfd fds[2] = {{ ws_.fd(), POLLIN, 0 }, { wakeup_[0], POLLIN, 0 }};
+                    ::poll(fds, 2, 10);
+                    if (fds[1].revents & POLLIN) {
+                        char buffer[64];
+                        while (::read(wakeup_[0], buffer, sizeof(buffer)) > 0) {}
+                    }
+                }
 
-    class CategoryModels {
-        OpenAI& openai_;
+                bool open = ws_.receive();
+
+                int opcode;
+                string payload;
+                while (ws_.next(opcode, payload)) {
+                    if (opcode == WebSocket::text) {
+                        json event = json::parse(payload, nullptr, false);
+                        if (event.is_discarded()) continue;
+
+                        string type = event.value("type", "");
+                        if (type == "response.audio.delta" || type == "response.output_audio.delta") {
+                            string pcm = base64_decode(event.value("delta", ""));
+                            size_t samples = pcm.size() / sizeof(int16_t);
+                            size_t written = output_audio_.write(reinterpret_cast<const int16_t*>(pcm.data()), samples);
+                            dropped_samples_ += samples - written;
+                        }
+                        dispatch(event);
+                    } else if (opcode == WebSocket::ping) {
+                        ws_.send(WebSocket::pong, payload.data(), payload.size());
+                    } else if (opcode == WebSocket::close) {
+                        ws_.send(WebSocket::close, payload.data(), min<size_t>(payload.size(), 2));
+                        open = false;
+                    }
+                }
+                if (!open) break;
 
-        public:
-            CategoryModels(OpenAI& openai) : 
-                openai_{openai} {}
+                {
+                    lock_guard<mutex> lock(outgoing_mutex_);
+                    outgoing.swap(outgoing_);
+                }
+                for (auto& event: outgoing) {
+                    send_audio(event.audio_mark);
+                    ws_.send(WebSocket::text, event.text.data(), event.text.size());
+                }
+                outgoing.clear();
+
+                // audio written after an event that is already queued waits for
+                // the next round, so it never overtakes that event.
+                uint64_t until;
+                {
+                    lock_guard<mutex> lock(outgoing_mutex_);
+                    until = outgoing_.empty() ? input_audio_.written() : outgoing_.front().audio_mark;
+                }
+                send_audio(until);
+            }
 
-            json list();
-            json retrieve(const string& model);
-            json del(const string& model);
-    };
+            if (running_) {
+                dispatch({{ "type", "close" }});
+            } else {
+                ws_.send(WebSocket::close, "\x03\xe8", 2);
+            }
+        } catch (const exception& e) {
+            dispatch({{ "type", "error" }, { "error", {{ "message", e.what() }} }});
+        }
+        running_ = false;
+    }
 
-    class CategoryModerations {
+    class CategoryRealtime {
         OpenAI& openai_;
 
         public:
-            CategoryModerations(OpenAI& openai) : 
+            CategoryRealtime(OpenAI& openai) : 
                 openai_{openai} {}
 
-            json create(json request);
+            // opens a realtime session for the model over wss:// (ws:// for http
+            // base uris). the session configuration, if any, is sent first.
+            unique_ptr<RealtimeSession> connect(const string& model, 
+                                                const json& session = json(), 
+                                                chrono::milliseconds timeout = chrono::seconds(10));
     };
 
     class OpenAI {
         Session session_;
+        SingleFlight single_flight_;
+        Accounting accounting_;
+
+        json account(json&& response, bool events);
+        static json stream_usage(const string& events);
 
         public:
             OpenAI(const string& scheme_host_port, 
@@ -235,13 +1836,29 @@ namespace openai {
 
             void stop();
 
-            json get(const string& path);
+            void set_single_flight(bool enable);
+            SingleFlight& single_flight();
+
+            shared_future<size_t> warmup(size_t connections);
+
+            static json decode(session_result&& result);
+
+            Accounting& accounting();
+
+            string base_uri() const;
+            string token();
+
+            json get(const string& path, 
+                     const RequestOptions& options = RequestOptions());
             json post(const string& path, 
-                      const string& data, 
-                      const string& content_type = "application/json");
+                      string data, 
+                      const string& content_type = "application/json", 
+                      const RequestOptions& options = RequestOptions());
             json post(const string& path, 
-                      const UploadFormDataItems& items);
-            json del(const string& path);
+                      const UploadFormDataItems& items, 
+                      const RequestOptions& options = RequestOptions());
+            json del(const string& path, 
+                     const RequestOptions& options = RequestOptions());
 
         public:
             CategoryAudio audio { *this };
@@ -252,6 +1869,7 @@ namespace openai {
             CategoryImages images { *this };
             CategoryModerations moderations { *this };
             CategoryModels models { *this };
+            CategoryRealtime realtime { *this };
     };
 
     inline OpenAI::OpenAI(const string& scheme_host_port, 
@@ -276,315 +1894,706 @@ namespace openai {
         session_.stop();
     }
 
-    inline json OpenAI::get(const string& path) {
-        int result;
-        string response;
+    inline string OpenAI::base_uri() const {
+        return session_.scheme_host_port();
+    }
 
-        tie(result, response) = session_.get(path);
-        if (result) {
-            throw runtime_error(response);
-        }
+    inline string OpenAI::token() {
+        return session_.token();
+    }
 
-        try {
-            return json::parse(response);
-        } catch (const exception& ) {
-            return {{ "response", response }};
-        }
+    inline shared_future<size_t> OpenAI::warmup(size_t connections) {
+        return session_.warmup(connections);
     }
 
-    inline json OpenAI::post(const string& path, 
-                      const string& data, 
-                      const string& content_type /* = "application/json" */) {
-        int result;
-        string response;
+    inline void OpenAI::set_single_flight(bool enable) {
+        single_flight_.enable(enable);
+    }
+
+    inline SingleFlight& OpenAI::single_flight() {
+        return single_flight_;
+    }
 
-        tie(result, response) = session_.post(path, data, content_type);
-        if (result) {
+    // the body is moved from the socket buffer into the result; a body that is
+    // not json, e.g. audio from /v1/audio/speech, is moved into {"response": ...}.
+    inline json OpenAI::decode(session_result&& result) {
+        auto& [code, response] = result;
+        if (code) {
             throw runtime_error(response);
         }
 
-        try {
-            return json::parse(response);
-        } catch (const exception& ) {
-            return {{ "response", response }};
+        json parsed = json::parse(response, nullptr, false);
+        if (parsed.is_discarded()) {
+            json wrapped = json::object();
+            wrapped["response"] = move(response);
+            return wrapped;
         }
+        return parsed;
     }
 
-    inline json OpenAI::post(const string& path, 
-                      const UploadFormDataItems& items) {
-        int result;
-        string response;
+    inline json OpenAI::get(const string& path, 
+                     const RequestOptions& options /* = RequestOptions() */) {
+        auto call = [&]() -> json {
+            return decode(session_.get(path, options));
+        };
 
-        tie(result, response) = session_.post(path, items);
-        if (result) {
-            throw runtime_error(response);
+        // calls that can be interrupted on their own never share an upstream call.
+        if (!single_flight_.enabled() || options.interruptible()) {
+            return call();
         }
+        return single_flight_.run(SingleFlight::key("GET", path), call);
+    }
 
-        try {
-            return json::parse(response);
-        } catch (const exception& ) {
-            return {{ "response", response }};
+    inline json OpenAI::post(const string& path, 
+                      string data, 
+                      const string& content_type /* = "application/json" */, 
+                      const RequestOptions& options /* = RequestOptions() */) {
+        accounting_.admit();
+        // the only non-json body a chat completion has is a stream of events.
+        bool events = path == "/v1/chat/completions";
+
+        // calls that can be interrupted on their own never share an upstream call.
+        if (!single_flight_.enabled() || options.interruptible()) {
+            return account(decode(session_.post(path, move(data), content_type, options)), events);
         }
+
+        // bodies are compared byte for byte, so only requests serialized the same
+        // way coalesce. the categories dump nlohmann::json, whose object keys are
+        // sorted, which makes equal requests equal bodies; callers posting their
+        // own strings have to serialize them canonically to share calls.
+        return single_flight_.run(SingleFlight::key("POST", path, content_type, data), [&]() -> json {
+            return account(decode(session_.post(path, move(data), content_type, options)), events);
+        });
     }
 
-    inline json OpenAI::del(const string& path) {
-        int result;
-        string response;
+    inline json OpenAI::post(const string& path, 
+                      const UploadFormDataItems& items, 
+                      const RequestOptions& options /* = RequestOptions() */) {
+        accounting_.admit();
+        return account(decode(session_.post(path, items, options)), false);
+    }
 
-        tie(result, response) = session_.del(path);
-        if (result) {
-            throw runtime_error(response);
+    // coalesced callers share the leader's response, so its usage is counted once.
+    // a streamed response is kept as {"response": "<events>"}; its usage comes in
+    // the last chunk, when the request asked for it with stream_options. other
+    // non-json bodies, e.g. speech audio, are never scanned.
+    inline json OpenAI::account(json&& response, bool events) {
+        if (!response.is_object()) return move(response);
+
+        auto usage = response.find("usage");
+        if (usage != response.end() && usage->is_object()) {
+            accounting_.record(response.value("model", ""), *usage);
+        } else {
+            auto body = response.find("response");
+            if (events && body != response.end() && body->is_string()) {
+                json chunk = stream_usage(body->get_ref<const string&>());
+                if (!chunk.is_null()) {
+                    accounting_.record(chunk.value("model", ""), chunk["usage"]);
+                }
+            }
         }
+        return move(response);
+    }
 
-        try {
-            return json::parse(response);
-        } catch (const exception& ) {
-            return {{ "response", response }};
+    // scans the server-sent events from the end, where the usage chunk sits right
+    // before "[DONE]"; only the last few events are parsed.
+    inline json OpenAI::stream_usage(const string& events) {
+        size_t end = events.size();
+        for (int scanned = 0; scanned < 4 && end > 0; scanned++) {
+            size_t begin = events.rfind("data: ", end - 1);
+            if (begin == string::npos) break;
+
+            size_t eol = events.find('\n', begin);
+            size_t stop = eol == string::npos || eol > end ? end : eol;
+            json chunk = json::parse(events.begin() + begin + 6, events.begin() + stop, nullptr, false);
+            if (chunk.is_object() && chunk.contains("usage") && chunk["usage"].is_object()) {
+                return chunk;
+            }
+            end = begin;
         }
+        return json();
+    }
+
+    inline Accounting& OpenAI::accounting() {
+        return accounting_;
     }
 
-    inline string CategoryAudio::speech(json request) {
-        json res = openai_.post("/v1/audio/speech", request.dump());
-        return res["response"].get<string>();
+    inline json OpenAI::del(const string& path, 
+                     const RequestOptions& options /* = RequestOptions() */) {
+        return decode(session_.del(path, options));
     }
 
-    inline json CategoryAudio::transcription(json request) {
+    inline string CategoryAudio::speech(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        json res = openai_.post("/v1/audio/speech", request.dump(), "application/json", options);
+        return move(res["response"].get_ref<string&>());
+    }
+
+    inline UploadFormDataItems CategoryAudio::transcription_items(const json& request) {
         UploadFormDataItems items;
 
         if (request.contains("file")) {
             string path = request["file"].get<string>();
             string content = file_content(path);
-            items.push_back({"file", content, path, "audio/mpeg"});
+            items.push_back({"file", move(content), path, "audio/mpeg"});
         }
 
         if (request.contains("model")) {
             string model = request["model"].get<string>();
-            items.push_back({"model", model, "", ""});
+            items.push_back({"model", move(model), "", ""});
         }
 
         if (request.contains("language")) {
             string language = request["language"].get<string>();
-            items.push_back({"language", language, "", ""});
+            items.push_back({"language", move(language), "", ""});
         }
 
         if (request.contains("prompt")) {
             string prompt = request["prompt"].get<string>();
-            items.push_back({"prompt", prompt, "", ""});
+            items.push_back({"prompt", move(prompt), "", ""});
         }
 
         if (request.contains("response_format")) {
             string response_format = request["response_format"].get<string>();
-            items.push_back({"response_format", response_format, "", ""});
+            items.push_back({"response_format", move(response_format), "", ""});
         }
 
         if (request.contains("temperature")) {
             string temperature = to_string(request["temperature"].get<float>());
-            items.push_back({"temperature", temperature, "", ""});
+            items.push_back({"temperature", move(temperature), "", ""});
         }
 
-        return openai_.post("/v1/audio/transcriptions", items);
+        return items;
+    }
+
+    inline json CategoryAudio::transcription(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/audio/transcriptions", transcription_items(request), options);
     }
 
-    inline json CategoryAudio::translation(json request) {
+    inline UploadFormDataItems CategoryAudio::translation_items(const json& request) {
         UploadFormDataItems items;
 
         if (request.contains("file")) {
             string path = request["file"].get<string>();
             string content = file_content(path);
-            items.push_back({"file", content, path, "audio/mpeg"});
+            items.push_back({"file", move(content), path, "audio/mpeg"});
         }
 
         if (request.contains("model")) {
             string model = request["model"].get<string>();
-            items.push_back({"model", model, "", ""});
+            items.push_back({"model", move(model), "", ""});
         }
 
         if (request.contains("prompt")) {
             string prompt = request["prompt"].get<string>();
-            items.push_back({"prompt", prompt, "", ""});
+            items.push_back({"prompt", move(prompt), "", ""});
         }
 
         if (request.contains("response_format")) {
             string response_format = request["response_format"].get<string>();
-            items.push_back({"response_format", response_format, "", ""});
+            items.push_back({"response_format", move(response_format), "", ""});
         }
 
         if (request.contains("temperature")) {
             string temperature = to_string(request["temperature"].get<float>());
-            items.push_back({"temperature", temperature, "", ""});
+            items.push_back({"temperature", move(temperature), "", ""});
         }
 
-        return openai_.post("/v1/audio/translations", items);
+        return items;
     }
 
-    inline json CategoryChat::create(json request) {
-        return openai_.post("/v1/chat/completions", request.dump());
+    inline json CategoryAudio::translation(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/audio/translations", translation_items(request), options);
+    }
+
+    inline json CategoryChat::create(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        // a stream only reports usage when asked to; see Accounting::set_stream_usage.
+        if (request.value("stream", false) && !request.contains("stream_options") && 
+            openai_.accounting().stream_usage()) {
+            json accounted = request;
+            accounted["stream_options"] = {{ "include_usage", true }};
+            return openai_.post("/v1/chat/completions", accounted.dump(), "application/json", options);
+        }
+        return openai_.post("/v1/chat/completions", request.dump(), "application/json", options);
+    }
+
+    inline json CategoryChat::moderation_input(const json& request) {
+        json input = json::array();
+        auto messages = request.find("messages");
+        if (messages == request.end() || !messages->is_array()) return input;
+
+        for (auto& message: *messages) {
+            if (message.value("role", "") != "user") continue;
+
+            auto content = message.find("content");
+            if (content == message.end()) continue;
+            if (content->is_string()) {
+                input.push_back(*content);
+            } else if (content->is_array()) {
+                for (auto& part: *content) {
+                    if (part.value("type", "") == "text" && part.contains("text")) {
+                        input.push_back(part["text"]);
+                    }
+                }
+            }
+        }
+        return input;
+    }
+
+    inline json CategoryChat::create_gated(const json& request, 
+                                           const RequestOptions& options /* = RequestOptions() */, 
+                                           const json& moderation /* = json::object() */) {
+        json input = moderation_input(request);
+        if (input.empty()) {
+            return create(request, options);
+        }
+
+        struct Gate {
+            mutex lock;
+            bool passed = false;
+            bool flagged = false;
+            bool abandoned = false;
+            json verdict;
+            string pending;
+        };
+        auto gate = make_shared<Gate>();
+
+        // both calls get their own token, so either can be stopped without
+        // touching the caller's, which still cancels them both.
+        RequestOptions chat_options = options;
+        chat_options.cancellation = CancellationToken();
+        RequestOptions moderation_options = options;
+        moderation_options.cancellation = CancellationToken();
+        moderation_options.on_data = nullptr;
+
+        CancellationToken chat_token = chat_options.cancellation;
+        CancellationToken moderation_token = moderation_options.cancellation;
+        struct Hook {
+            const CancellationToken& token;
+            size_t id;
+            ~Hook() { token.remove(id); }
+        } hook{ options.cancellation, options.cancellation.on_cancel([chat_token, moderation_token]() mutable {
+            chat_token.cancel();
+            moderation_token.cancel();
+        })};
+
+        if (options.on_data) {
+            chat_options.on_data = [gate, on_data = options.on_data](const char* data, size_t length) {
+                lock_guard<mutex> lock(gate->lock);
+                if (gate->passed) return on_data(data, length);
+                if (gate->flagged) return false;
+                gate->pending.append(data, length);
+                return true;
+            };
+        }
+
+        json moderation_request = moderation;
+        moderation_request["input"] = move(input);
+        // the tag is thread local, so it is handed to the moderation thread.
+        string tag = UsageTag::current();
+
+        // the verdict is applied on the moderation thread as soon as it arrives, so a
+        // clean stream is flushed without waiting for its next chunk. on_data may
+        // therefore be called once from that thread, never concurrently.
+        auto moderated = async(launch::async, [&, gate]() mutable {
+            UsageTag scope(tag);
+            try {
+                json result = openai_.moderations.create(moderation_request, moderation_options);
+
+                bool flagged = true;
+                if (result.contains("results") && result["results"].is_array()) {
+                    flagged = false;
+                    for (auto& r: result["results"]) {
+                        flagged = flagged || r.value("flagged", false);
+                    }
+                }
+
+                lock_guard<mutex> lock(gate->lock);
+                gate->verdict = move(result);
+                if (flagged) {
+                    // an unreadable verdict fails closed like a flagged one.
+                    gate->flagged = true;
+                    gate->pending.clear();
+                    chat_token.cancel();
+                    return;
+                }
+
+                gate->passed = true;
+                if (!gate->pending.empty()) {
+                    string pending = move(gate->pending);
+                    gate->pending.clear();
+                    if (!options.on_data(pending.data(), pending.size())) {
+                        chat_token.cancel();
+                    }
+                }
+            } catch (const exception& e) {
+                // a moderation call that fails, times out or is over budget fails
+                // closed too; an on_data that throws while flushing stops the chat.
+                lock_guard<mutex> lock(gate->lock);
+                if (!gate->passed) {
+                    gate->flagged = true;
+                    gate->verdict = {{ "error", {{ "message", e.what() }} }};
+                    gate->pending.clear();
+                }
+                chat_token.cancel();
+            }
+        });
+
+        // a flag usually lands while the completion is still running, which then
+        // fails as "Canceled"; that is reported as a ModerationError below.
+        json response;
+        exception_ptr chat_error;
+        try {
+            response = create(request, chat_options);
+        } catch (...) {
+            chat_error = current_exception();
+
+            // the completion failed on its own, there is nothing left to release.
+            lock_guard<mutex> lock(gate->lock);
+            if (!gate->passed && !gate->flagged) {
+                gate->abandoned = true;
+                moderation_token.cancel();
+            }
+        }
+        moderated.wait();
+
+        if (chat_error && options.cancellation.cancelled()) {
+            rethrow_exception(chat_error);
+        }
+        if (gate->flagged && !gate->abandoned) {
+            bool results = gate->verdict.contains("results");
+            throw ModerationError(results ? "input was flagged by moderation" : "moderation did not complete", 
+                                  move(gate->verdict));
+        }
+        if (chat_error) {
+            rethrow_exception(chat_error);
+        }
+        return response;
     }
 
-    inline json CategoryEmbedding::create(json request) {
-        return openai_.post("/v1/embeddings", request.dump());
+    inline json CategoryEmbedding::create(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/embeddings", request.dump(), "application/json", options);
     }
 
-    inline json CategoryFinetunning::create(json request) {
-        return openai_.post("/v1/fine_tuning/jobs", request.dump());
+    inline json CategoryFinetunning::create(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/fine_tuning/jobs", request.dump(), "application/json", options);
     }
 
-    inline json CategoryFinetunning::list() {
-        return openai_.get("/v1/fine_tuning/jobs");
+    inline json CategoryFinetunning::list(const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get("/v1/fine_tuning/jobs", options);
     }
 
-    inline json CategoryFinetunning::events(const string& fine_tuning_job_id) {
-        return openai_.get(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id + "/events");
+    inline json CategoryFinetunning::events(const string& fine_tuning_job_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id + "/events", options);
     }
 
-    inline json CategoryFinetunning::checkpoints(const string& fine_tuning_job_id) {
-        return openai_.get(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id + "/checkpoints");
+    inline json CategoryFinetunning::checkpoints(const string& fine_tuning_job_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id + "/checkpoints", options);
     }
 
-    inline json CategoryFinetunning::retrieve(const string& fine_tuning_job_id) {
-        return openai_.get(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id);
+    inline json CategoryFinetunning::retrieve(const string& fine_tuning_job_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id, options);
     }
 
-    inline json CategoryFinetunning::cancel(const string& fine_tuning_job_id) {
-        return openai_.post(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id + "/cancel", "");
+    inline json CategoryFinetunning::cancel(const string& fine_tuning_job_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post(string("/v1/fine_tuning/jobs/") + fine_tuning_job_id + "/cancel", "", "application/json", options);
     }
 
-    inline json CategoryFiles::upload(json request) {
+    inline UploadFormDataItems CategoryFiles::upload_items(const json& request) {
         UploadFormDataItems items;
 
         if (request.contains("file")) {
             string path = request["file"].get<string>();
             string content = file_content(path);
-            items.push_back({"file", content, path, "application/json"});
+            items.push_back({"file", move(content), path, "application/json"});
         }
 
         if (request.contains("purpose")) {
             string purpose = request["purpose"].get<string>();
-            items.push_back({"purpose", purpose, "", ""});
+            items.push_back({"purpose", move(purpose), "", ""});
         }
 
-        return openai_.post("/v1/files", items);
+        return items;
+    }
+
+    inline json CategoryFiles::upload(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/files", upload_items(request), options);
     }
 
-    inline json CategoryFiles::list() {
-        return openai_.get("/v1/files");
+    inline json CategoryFiles::list(const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get("/v1/files", options);
     }
 
-    inline json CategoryFiles::retrieve(const string& file_id) {
-        return openai_.get(string("/v1/files/") + file_id);
+    inline json CategoryFiles::retrieve(const string& file_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get(string("/v1/files/") + file_id, options);
     }
 
-    inline json CategoryFiles::del(const string& file_id) {
-        return openai_.del(string("/v1/files/") + file_id);
+    inline json CategoryFiles::del(const string& file_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.del(string("/v1/files/") + file_id, options);
     }
 
-    inline json CategoryFiles::content(const string& file_id) {
-        return openai_.get(string("/v1/files/") + file_id + "/content");
+    inline json CategoryFiles::content(const string& file_id, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get(string("/v1/files/") + file_id + "/content", options);
     }
 
-    inline json CategoryImages::create(json request) {
-        return openai_.post("/v1/images/generations", request.dump());
+    inline json CategoryImages::create(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/images/generations", request.dump(), "application/json", options);
     }
 
-    inline json CategoryImages::edit(json request) {
+    inline UploadFormDataItems CategoryImages::edit_items(const json& request) {
         UploadFormDataItems items;
 
         if (request.contains("image")) {
             string path = request["image"].get<string>();
             string content = file_content(path);
-            items.push_back({"image", content, path, "image/png"});
+            items.push_back({"image", move(content), path, "image/png"});
         }
 
         if (request.contains("prompt")) {
             string prompt = request["prompt"].get<string>();
-            items.push_back({"prompt", prompt, "", ""});
+            items.push_back({"prompt", move(prompt), "", ""});
         }
 
         if (request.contains("mask")) {
             string path = request["mask"].get<string>();
             string content = file_content(path);
-            items.push_back({"mask", content, path, "image/png"});
+            items.push_back({"mask", move(content), path, "image/png"});
         }
 
         if (request.contains("model")) {
             string model = request["model"].get<string>();
-            items.push_back({"model", model, "", ""});
+            items.push_back({"model", move(model), "", ""});
         }
 
         if (request.contains("n")) {
             string n = to_string(request["n"].get<int>());
-            items.push_back({"n", n, "", ""});
+            items.push_back({"n", move(n), "", ""});
         }
 
         if (request.contains("size")) {
             string size = to_string(request["size"].get<int>());
-            items.push_back({"size", size, "", ""});
+            items.push_back({"size", move(size), "", ""});
         }
 
         if (request.contains("response_format")) {
             string response_format = request["response_format"].get<string>();
-            items.push_back({"response_format", response_format, "", ""});
+            items.push_back({"response_format", move(response_format), "", ""});
         }
 
         if (request.contains("user")) {
             string user = request["user"].get<string>();
-            items.push_back({"user", user, "", ""});
+            items.push_back({"user", move(user), "", ""});
         }
 
-        return openai_.post("/v1/images/edits", items);
+        return items;
+    }
+
+    inline json CategoryImages::edit(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/images/edits", edit_items(request), options);
     }
 
-    inline json CategoryImages::variation(json request) {
+    inline UploadFormDataItems CategoryImages::variation_items(const json& request) {
         UploadFormDataItems items;
 
         if (request.contains("image")) {
             string path = request["image"].get<string>();
             string content = file_content(path);
-            items.push_back({"image", content, path, "image/png"});
+            items.push_back({"image", move(content), path, "image/png"});
         }
 
         if (request.contains("model")) {
             string model = request["model"].get<string>();
-            items.push_back({"model", model, "", ""});
+            items.push_back({"model", move(model), "", ""});
         }
 
         if (request.contains("n")) {
             string n = to_string(request["n"].get<int>());
-            items.push_back({"n", n, "", ""});
+            items.push_back({"n", move(n), "", ""});
         }
 
         if (request.contains("response_format")) {
             string response_format = request["response_format"].get<string>();
-            items.push_back({"response_format", response_format, "", ""});
+            items.push_back({"response_format", move(response_format), "", ""});
         }
 
         if (request.contains("size")) {
             string size = to_string(request["size"].get<int>());
-            items.push_back({"size", size, "", ""});
+            items.push_back({"size", move(size), "", ""});
         }
 
         if (request.contains("user")) {
             string user = request["user"].get<string>();
-            items.push_back({"user", user, "", ""});
+            items.push_back({"user", move(user), "", ""});
         }
 
-        return openai_.post("/v1/images/variations", items);
+        return items;
+    }
+
+    inline json CategoryImages::variation(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/images/variations", variation_items(request), options);
+    }
+
+    inline json CategoryModels::list(const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get("/v1/models", options);
+    }
+
+    inline json CategoryModels::retrieve(const string& model, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.get(string("/v1/models/") + model, options);
+    }
+
+    inline json CategoryModels::del(const string& model, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.del(string("/v1/models/") + model, options);
+    }
+
+    inline json CategoryModerations::create(const json& request, const RequestOptions& options /* = RequestOptions() */) {
+        return openai_.post("/v1/moderations", request.dump(), "application/json", options);
     }
 
-    inline json CategoryModels::list() {
-        return openai_.get("/v1/models");
+    inline ToolRunner& ToolRunner::add(const string& name, 
+                                       const string& description, 
+                                       const json& parameters, 
+                                       function<json(const json& arguments)> call) {
+        tools_[name] = {
+            {
+                { "type", "function" },
+                { "function", {
+                    { "name", name },
+                    { "description", description },
+                    { "parameters", parameters }
+                }}
+            },
+            move(call)
+        };
+        return *this;
     }
 
-    inline json CategoryModels::retrieve(const string& model) {
-        return openai_.get(string("/v1/models/") + model);
+    // never throws: a failing tool reports its error to the model instead.
+    inline json ToolRunner::invoke(const json& tool_call) const {
+        try {
+            const json& function = tool_call.at("function");
+            string name = function.at("name").get<string>();
+
+            auto it = tools_.find(name);
+            if (it == tools_.end()) {
+                return {{ "error", "unknown tool: " + name }};
+            }
+
+            string arguments = function.value("arguments", "{}");
+            return it->second.call(json::parse(arguments.empty() ? "{}" : arguments));
+        } catch (const exception& e) {
+            return {{ "error", e.what() }};
+        }
     }
 
-    inline json CategoryModels::del(const string& model) {
-        return openai_.del(string("/v1/models/") + model);
+    inline json ToolRunner::run(json& request, const RequestOptions& options /* = RequestOptions() */) {
+        // tool calls are read from the completed message, which a stream never has.
+        if (request.value("stream", false)) {
+            throw runtime_error("tool calls can not be run on a streamed completion");
+        }
+        if (!request.contains("messages")) {
+            request["messages"] = json::array();
+        }
+
+        // everything but the messages is serialized once, and each message is
+        // serialized once when it joins the conversation, so a round only costs
+        // the new messages plus a string concatenation.
+        json head = request;
+        head.erase("messages");
+        if (!tools_.empty()) {
+            // registered tools join the caller's own; a tool both declare must be
+            // declared the same way, since only the registered one is dispatched.
+            json tools = head.contains("tools") ? head["tools"] : json::array();
+            if (!tools.is_array()) {
+                throw runtime_error("request tools must be an array");
+            }
+            for (const auto& tool: tools_) {
+                auto declared = find_if(tools.begin(), tools.end(), [&](const json& t) {
+                    return t.value("type", "") == "function" && 
+                           t.contains("function") && 
+                           t["function"].value("name", "") == tool.first;
+                });
+                if (declared == tools.end()) {
+                    tools.push_back(tool.second.definition);
+                } else if (*declared != tool.second.definition) {
+                    throw runtime_error("tool " + tool.first + " is declared differently in the request");
+                }
+            }
+            head["tools"] = move(tools);
+        }
+        string prefix = head.dump();
+        prefix.pop_back();
+        prefix += prefix.size() > 1 ? ",\"messages\":[" : "\"messages\":[";
+
+        string messages;
+        auto append = [&](const json& message) {
+            if (!messages.empty()) messages += ',';
+            messages += message.dump();
+        };
+        for (const auto& message: request["messages"]) {
+            append(message);
+        }
+
+        for (size_t round = 0; round < max_rounds_; round++) {
+            json response = openai_.post("/v1/chat/completions", 
+                                         prefix + messages + "]}", 
+                                         "application/json", 
+                                         options);
+
+            json message = response.at("choices").at(0).at("message");
+            request["messages"].push_back(message);
+            append(message);
+
+            if (!message.contains("tool_calls") || message["tool_calls"].empty()) {
+                return response;
+            }
+
+            vector<future<json>> results;
+            for (const auto& tool_call: message["tool_calls"]) {
+                results.push_back(pool_.submit([this, &tool_call] { return invoke(tool_call); }));
+            }
+
+            vector<json> outputs;
+            for (auto& result: results) {
+                outputs.push_back(result.get());
+            }
+
+            for (size_t i = 0; i < outputs.size(); i++) {
+                const json& result = outputs[i];
+                json tool_message = {
+                    { "role", "tool" },
+                    { "tool_call_id", message["tool_calls"][i].at("id") },
+                    { "content", result.is_string() ? result.get<string>() : result.dump() }
+                };
+                request["messages"].push_back(tool_message);
+                append(tool_message);
+            }
+        }
+
+        throw runtime_error("tool calls did not finish within " + to_string(max_rounds_) + " rounds");
     }
 
-    inline json CategoryModerations::create(json request) {
-        return openai_.post("/v1/moderations", request.dump());
+    inline unique_ptr<RealtimeSession> CategoryRealtime::connect(const string& model, 
+                                                                 const json& session /* = json() */, 
+                                                                 chrono::milliseconds timeout /* = chrono::seconds(10) */) {
+        string url = openai_.base_uri();
+        if (url.compare(0, 8, "https://") == 0) {
+            url = "wss://" + url.substr(8);
+        } else if (url.compare(0, 7, "http://") == 0) {
+            url = "ws://" + url.substr(7);
+        }
+        url += "/v1/realtime?model=" + model;
+
+        Headers headers = {{ "OpenAI-Beta", "realtime=v1" }};
+        string token = openai_.token();
+        if (!token.empty()) {
+            headers.emplace("Authorization", "Bearer " + token);
+        }
+
+        unique_ptr<RealtimeSession> realtime(new RealtimeSession());
+        realtime->open(url, headers, timeout);
+        if (!session.is_null()) {
+            realtime->update(session);
+        }
+        return realtime;
     }
 
     inline OpenAI& start(const string& scheme_host_port = "", 
@@ -603,6 +2612,14 @@ namespace openai {
         instance().stop();
     }
 
+    inline shared_future<size_t> warmup(size_t connections = 1) {
+        return instance().warmup(connections);
+    }
+
+    inline Accounting& accounting() {
+        return instance().accounting();
+    }
+
     inline CategoryAudio& audio() {
         return instance().audio;
     }
@@ -634,4 +2651,8 @@ namespace openai {
     inline CategoryModels& models() {
         return instance().models;
     }
+
+    inline CategoryRealtime& realtime() {
+        return instance().realtime;
+    }
 }
\ No newline at end of file
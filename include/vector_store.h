@@ -0,0 +1,547 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define OPENAI_VECTOR_X86 1
+#endif
+
+namespace openai {
+    using std::string;
+    using std::vector;
+
+    enum class Metric : uint32_t {
+        cosine = 0,
+        dot = 1
+    };
+
+    struct SearchHit {
+        size_t id;
+        float score;
+    };
+
+    template <typename T, size_t Alignment = 64>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template <typename U>
+        struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+        AlignedAllocator() = default;
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>& ) {}
+
+        T* allocate(size_t n) {
+            void* p = nullptr;
+            if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T* p, size_t ) { free(p); }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>& ) const { return true; }
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>& ) const { return false; }
+    };
+
+    namespace kernels {
+        // rows are zero padded to a multiple of 16 lanes, so every kernel walks
+        // whole 64 byte blocks and needs no tail handling.
+        inline float dot_scalar(const float* a, const float* b, size_t n) {
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; i++) {
+                sum += a[i] * b[i];
+            }
+            return sum;
+        }
+
+        inline float dot_i8_scalar(const float* q, const int8_t* row, size_t n) {
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; i++) {
+                sum += q[i] * row[i];
+            }
+            return sum;
+        }
+
+#ifdef OPENAI_VECTOR_X86
+#pragma GCC diagnostic push
+// gcc's avx512 intrinsics read deliberately undefined registers.
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+        __attribute__((target("avx2,fma")))
+        inline float hsum256(__m256 v) {
+            __m128 lo = _mm256_castps256_ps128(v);
+            __m128 hi = _mm256_extractf128_ps(v, 1);
+            lo = _mm_add_ps(lo, hi);
+            lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+            lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+            return _mm_cvtss_f32(lo);
+        }
+
+        __attribute__((target("avx2,fma")))
+        inline float dot_avx2(const float* a, const float* b, size_t n) {
+            __m256 s0 = _mm256_setzero_ps();
+            __m256 s1 = _mm256_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                s0 = _mm256_fmadd_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i), s0);
+                s1 = _mm256_fmadd_ps(_mm256_load_ps(a + i + 8), _mm256_load_ps(b + i + 8), s1);
+            }
+            return hsum256(_mm256_add_ps(s0, s1));
+        }
+
+        __attribute__((target("avx2,fma")))
+        inline float dot_i8_avx2(const float* q, const int8_t* row, size_t n) {
+            __m256 s0 = _mm256_setzero_ps();
+            __m256 s1 = _mm256_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                __m128i r = _mm_load_si128(reinterpret_cast<const __m128i*>(row + i));
+                __m256 r0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(r));
+                __m256 r1 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(r, 8)));
+                s0 = _mm256_fmadd_ps(_mm256_load_ps(q + i), r0, s0);
+                s1 = _mm256_fmadd_ps(_mm256_load_ps(q + i + 8), r1, s1);
+            }
+            return hsum256(_mm256_add_ps(s0, s1));
+        }
+
+        __attribute__((target("avx512f")))
+        inline float dot_avx512(const float* a, const float* b, size_t n) {
+            __m512 sum = _mm512_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                sum = _mm512_fmadd_ps(_mm512_load_ps(a + i), _mm512_load_ps(b + i), sum);
+            }
+            return _mm512_reduce_add_ps(sum);
+        }
+
+        __attribute__((target("avx512f")))
+        inline float dot_i8_avx512(const float* q, const int8_t* row, size_t n) {
+            __m512 sum = _mm512_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                __m128i r = _mm_load_si128(reinterpret_cast<const __m128i*>(row + i));
+                sum = _mm512_fmadd_ps(_mm512_load_ps(q + i), _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(r)), sum);
+            }
+            return _mm512_reduce_add_ps(sum);
+        }
+#pragma GCC diagnostic pop
+#endif
+
+        using dot_fn = float (*)(const float*, const float*, size_t);
+        using dot_i8_fn = float (*)(const float*, const int8_t*, size_t);
+
+        inline dot_fn select_dot() {
+#ifdef OPENAI_VECTOR_X86
+            if (__builtin_cpu_supports("avx512f")) return dot_avx512;
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return dot_avx2;
+#endif
+            return dot_scalar;
+        }
+
+        inline dot_i8_fn select_dot_i8() {
+#ifdef OPENAI_VECTOR_X86
+            if (__builtin_cpu_supports("avx512f")) return dot_i8_avx512;
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return dot_i8_avx2;
+#endif
+            return dot_i8_scalar;
+        }
+
+        inline const char* isa() {
+#ifdef OPENAI_VECTOR_X86
+            if (__builtin_cpu_supports("avx512f")) return "avx512";
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return "avx2";
+#endif
+            return "scalar";
+        }
+    }
+
+    // a flat, 64 byte aligned matrix of embeddings with brute force top-k search.
+    // rows are either float or int8 with a per-row scale, and the whole store can
+    // be written to disk and mapped back without parsing.
+    //
+    // file layout, every section starting on a 64 byte boundary:
+    //   header   magic "OAIVEC01", metric, dims, stride, count, quantized
+    //   rows     count * stride floats, or count * stride int8 when quantized
+    //   scales   count floats, only when quantized
+    class VectorStore {
+        using float_buffer = vector<float, AlignedAllocator<float>>;
+        using int8_buffer = vector<int8_t, AlignedAllocator<int8_t>>;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t metric;
+            uint64_t dims;
+            uint64_t stride;
+            uint64_t count;
+            uint32_t quantized;
+            uint8_t reserved[20];
+        };
+        static_assert(sizeof(Header) == 64, "vector store header must be 64 bytes");
+
+        size_t dims_;
+        size_t stride_;
+        Metric metric_;
+        size_t count_ = 0;
+        bool quantized_ = false;
+
+        float_buffer rows_;
+        int8_buffer qrows_;
+        float_buffer scales_;
+
+        std::shared_ptr<void> mapping_;
+        const float* mapped_rows_ = nullptr;
+        const int8_t* mapped_qrows_ = nullptr;
+        const float* mapped_scales_ = nullptr;
+
+        kernels::dot_fn dot_ = kernels::select_dot();
+        kernels::dot_i8_fn dot_i8_ = kernels::select_dot_i8();
+
+        static size_t padded(size_t dims) { return (dims + 15) / 16 * 16; }
+        static size_t aligned(size_t bytes) { return (bytes + 63) / 64 * 64; }
+
+        const float* rows() const { return mapping_ ? mapped_rows_ : rows_.data(); }
+        const int8_t* qrows() const { return mapping_ ? mapped_qrows_ : qrows_.data(); }
+        const float* scales() const { return mapping_ ? mapped_scales_ : scales_.data(); }
+
+        void prepare_query(const float* query, float_buffer& out) const;
+        void search_prepared(const float* query, size_t k, vector<SearchHit>& hits) const;
+
+        public:
+            VectorStore(size_t dims = 0, Metric metric = Metric::cosine);
+
+            size_t dims() const { return dims_; }
+            size_t size() const { return count_; }
+            Metric metric() const { return metric_; }
+            bool quantized() const { return quantized_; }
+            bool mapped() const { return static_cast<bool>(mapping_); }
+
+            void reserve(size_t n);
+
+            size_t add(const float* embedding, size_t dims);
+            size_t add(const vector<float>& embedding);
+            size_t add(const nlohmann::json& response);
+
+            void quantize();
+
+            vector<SearchHit> search(const vector<float>& query, size_t k) const;
+            vector<vector<SearchHit>> search(const vector<vector<float>>& queries,
+                                             size_t k,
+                                             size_t threads = 0) const;
+
+            void save(const string& path) const;
+            static VectorStore open(const string& path);
+    };
+
+    inline VectorStore::VectorStore(size_t dims /* = 0 */, Metric metric /* = Metric::cosine */) :
+        dims_{dims}, stride_{padded(dims)}, metric_{metric} {}
+
+    inline void VectorStore::reserve(size_t n) {
+        if (quantized_) {
+            qrows_.reserve(n * stride_);
+            scales_.reserve(n);
+        } else {
+            rows_.reserve(n * stride_);
+        }
+    }
+
+    inline size_t VectorStore::add(const float* embedding, size_t dims) {
+        if (mapping_) {
+            throw std::runtime_error("vector store is mapped read-only");
+        }
+        if (dims_ == 0) {
+            dims_ = dims;
+            stride_ = padded(dims);
+        }
+        if (dims != dims_) {
+            throw std::runtime_error("embedding has " + std::to_string(dims) +
+                                     " dimensions, store has " + std::to_string(dims_));
+        }
+
+        float norm = 1.0f;
+        if (metric_ == Metric::cosine) {
+            norm = std::sqrt(kernels::dot_scalar(embedding, embedding, dims));
+            norm = norm > 0.0f ? norm : 1.0f;
+        }
+
+        if (quantized_) {
+            float max = 0.0f;
+            for (size_t i = 0; i < dims; i++) {
+                max = std::max(max, std::fabs(embedding[i] / norm));
+            }
+            float scale = max > 0.0f ? max / 127.0f : 1.0f;
+
+            size_t offset = qrows_.size();
+            qrows_.resize(offset + stride_, 0);
+            for (size_t i = 0; i < dims; i++) {
+                qrows_[offset + i] = static_cast<int8_t>(std::lround(embedding[i] / norm / scale));
+            }
+            scales_.push_back(scale);
+        } else {
+            size_t offset = rows_.size();
+            rows_.resize(offset + stride_, 0.0f);
+            for (size_t i = 0; i < dims; i++) {
+                rows_[offset + i] = embedding[i] / norm;
+            }
+        }
+        return count_++;
+    }
+
+    inline size_t VectorStore::add(const vector<float>& embedding) {
+        return add(embedding.data(), embedding.size());
+    }
+
+    // ingests a /v1/embeddings response, returns the id of the first row added.
+    // rows are appended in the order of the response's "index" fields.
+    inline size_t VectorStore::add(const nlohmann::json& response) {
+        const nlohmann::json& data = response.at("data");
+
+        vector<const nlohmann::json*> items(data.size(), nullptr);
+        size_t position = 0;
+        for (const auto& item: data) {
+            size_t index = item.value("index", position++);
+            if (index >= items.size()) {
+                throw std::runtime_error("embedding index out of range");
+            }
+            items[index] = &item;
+        }
+
+        size_t first = count_;
+        reserve(count_ + items.size());
+
+        vector<float> embedding;
+        for (auto item: items) {
+            if (item == nullptr) {
+                throw std::runtime_error("embedding response has missing indices");
+            }
+            item->at("embedding").get_to(embedding);
+            add(embedding);
+        }
+        return first;
+    }
+
+    // converts every row to int8 with a per-row scale, a quarter of the memory
+    // at a small loss of recall. rows added afterwards are quantized on ingest.
+    inline void VectorStore::quantize() {
+        if (quantized_) return;
+        if (mapping_) {
+            throw std::runtime_error("vector store is mapped read-only");
+        }
+
+        float_buffer rows;
+        rows.swap(rows_);
+        size_t count = count_;
+
+        count_ = 0;
+        quantized_ = true;
+        reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            // rows are already normalized for cosine, normalizing again is a no-op.
+            add(rows.data() + i * stride_, dims_);
+        }
+    }
+
+    inline void VectorStore::prepare_query(const float* query, float_buffer& out) const {
+        out.assign(stride_, 0.0f);
+        float norm = 1.0f;
+        if (metric_ == Metric::cosine) {
+            norm = std::sqrt(kernels::dot_scalar(query, query, dims_));
+            norm = norm > 0.0f ? norm : 1.0f;
+        }
+        for (size_t i = 0; i < dims_; i++) {
+            out[i] = query[i] / norm;
+        }
+    }
+
+    inline void VectorStore::search_prepared(const float* query, size_t k, vector<SearchHit>& hits) const {
+        auto worse = [](const SearchHit& a, const SearchHit& b) { return a.score > b.score; };
+        std::priority_queue<SearchHit, vector<SearchHit>, decltype(worse)> top(worse);
+
+        k = std::min(k, count_);
+        for (size_t i = 0; i < count_; i++) {
+            float score = quantized_ ?
+                dot_i8_(query, qrows() + i * stride_, stride_) * scales()[i] :
+                dot_(query, rows() + i * stride_, stride_);
+
+            if (top.size() < k) {
+                top.push({i, score});
+            } else if (k > 0 && score > top.top().score) {
+                top.pop();
+                top.push({i, score});
+            }
+        }
+
+        hits.resize(top.size());
+        for (size_t i = hits.size(); i > 0; i--) {
+            hits[i - 1] = top.top();
+            top.pop();
+        }
+    }
+
+    inline vector<SearchHit> VectorStore::search(const vector<float>& query, size_t k) const {
+        if (query.size() != dims_) {
+            throw std::runtime_error("query has " + std::to_string(query.size()) +
+                                     " dimensions, store has " + std::to_string(dims_));
+        }
+
+        float_buffer prepared;
+        prepare_query(query.data(), prepared);
+
+        vector<SearchHit> hits;
+        search_prepared(prepared.data(), k, hits);
+        return hits;
+    }
+
+    // spreads the queries over threads, each scanning the whole corpus; threads
+    // defaults to the hardware concurrency.
+    inline vector<vector<SearchHit>> VectorStore::search(const vector<vector<float>>& queries,
+                                                         size_t k,
+                                                         size_t threads /* = 0 */) const {
+        for (const auto& query: queries) {
+            if (query.size() != dims_) {
+                throw std::runtime_error("query has " + std::to_string(query.size()) +
+                                         " dimensions, store has " + std::to_string(dims_));
+            }
+        }
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = std::min(threads, std::max<size_t>(1, queries.size()));
+
+        vector<vector<SearchHit>> results(queries.size());
+        auto worker = [&](size_t begin) {
+            float_buffer prepared;
+            for (size_t i = begin; i < queries.size(); i += threads) {
+                prepare_query(queries[i].data(), prepared);
+                search_prepared(prepared.data(), k, results[i]);
+            }
+        };
+
+        vector<std::thread> pool;
+        for (size_t t = 1; t < threads; t++) {
+            pool.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto& t: pool) {
+            t.join();
+        }
+        return results;
+    }
+
+    inline void VectorStore::save(const string& path) const {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "OAIVEC01", 8);
+        header.version = 1;
+        header.metric = static_cast<uint32_t>(metric_);
+        header.dims = dims_;
+        header.stride = stride_;
+        header.count = count_;
+        header.quantized = quantized_ ? 1 : 0;
+
+        std::unique_ptr<FILE, int (*)(FILE*)> f(fopen(path.c_str(), "wb"), fclose);
+        if (!f) {
+            throw std::runtime_error("can not open " + path);
+        }
+
+        static const char zeros[64] = {};
+        auto write = [&](const void* data, size_t bytes) {
+            if (bytes > 0 && fwrite(data, 1, bytes, f.get()) != bytes) {
+                throw std::runtime_error("can not write " + path);
+            }
+            if (aligned(bytes) != bytes && fwrite(zeros, 1, aligned(bytes) - bytes, f.get()) != aligned(bytes) - bytes) {
+                throw std::runtime_error("can not write " + path);
+            }
+        };
+
+        write(&header, sizeof(header));
+        if (quantized_) {
+            write(qrows(), count_ * stride_);
+            write(scales(), count_ * sizeof(float));
+        } else {
+            write(rows(), count_ * stride_ * sizeof(float));
+        }
+
+        if (fflush(f.get()) != 0) {
+            throw std::runtime_error("can not write " + path);
+        }
+    }
+
+    // maps a saved store read-only; pages are faulted in lazily by the first
+    // searches, so opening is constant time regardless of corpus size.
+    inline VectorStore VectorStore::open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can not open " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("invalid vector store " + path);
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("can not map " + path);
+        }
+        std::shared_ptr<void> mapping(addr, [size](void* p) { munmap(p, size); });
+
+        // every header field is checked before it sizes anything, so a corrupt or
+        // crafted file can not make the searches read past the mapping.
+        const Header* header = static_cast<const Header*>(addr);
+        if (memcmp(header->magic, "OAIVEC01", 8) != 0 || header->version != 1 ||
+            header->metric > static_cast<uint32_t>(Metric::dot) || header->quantized > 1 ||
+            header->stride != padded(header->dims) || header->stride < header->dims ||
+            (header->stride == 0 && header->count != 0)) {
+            throw std::runtime_error("invalid vector store " + path);
+        }
+
+        // count is bounded by what the file can hold before any product is taken.
+        size_t payload = size - sizeof(Header);
+        size_t element = header->quantized ? 1 : sizeof(float);
+        if (header->stride != 0 && header->count > payload / element / header->stride) {
+            throw std::runtime_error("truncated vector store " + path);
+        }
+
+        size_t rows_bytes = header->count * header->stride * element;
+        size_t scales_bytes = header->quantized ? header->count * sizeof(float) : 0;
+        if (aligned(rows_bytes) > payload || scales_bytes > payload - aligned(rows_bytes)) {
+            throw std::runtime_error("truncated vector store " + path);
+        }
+
+        VectorStore store(header->dims, static_cast<Metric>(header->metric));
+        store.count_ = header->count;
+        store.quantized_ = header->quantized != 0;
+
+        const char* base = static_cast<const char*>(addr) + sizeof(Header);
+        if (store.quantized_) {
+            store.mapped_qrows_ = reinterpret_cast<const int8_t*>(base);
+            store.mapped_scales_ = reinterpret_cast<const float*>(base + aligned(rows_bytes));
+        } else {
+            store.mapped_rows_ = reinterpret_cast<const float*>(base);
+        }
+        store.mapping_ = mapping;
+        return store;
+    }
+}
@@ -0,0 +1,198 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+static int failures = 0;
+
+void check(bool condition, const string& what) {
+    cout << (condition ? "ok      " : "FAILED  ") << what << endl;
+    if (!condition) failures++;
+}
+
+template <typename F>
+double milliseconds(F f) {
+    auto begin = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+const json* find_usage(const json& snapshot, const string& model, const string& tag) {
+    for (auto& usage: snapshot["usage"]) {
+        if (usage["model"] == model && usage["tag"] == tag) return &usage;
+    }
+    return nullptr;
+}
+
+void merge() {
+    const int threads = 8;
+    const int records = 1000;
+
+    openai::Accounting accounting;
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            openai::UsageTag tag(t % 2 ? "odd" : "even");
+            for (int i = 0; i < records; i++) {
+                accounting.record(i % 2 ? "gpt-4o" : "gpt-4o-mini",
+                                  {{ "prompt_tokens", 2 }, { "completion_tokens", 1 }});
+            }
+        });
+    }
+    for (auto& worker: workers) worker.join();
+
+    json snapshot = accounting.snapshot();
+    check(snapshot["total_tokens"] == uint64_t(threads * records * 3), "merge: total across every shard");
+    check(snapshot["usage"].size() == 4, "merge: one entry per model and tag");
+
+    bool counted = true;
+    for (string model: { "gpt-4o", "gpt-4o-mini" }) {
+        for (string tag: { "odd", "even" }) {
+            const json* usage = find_usage(snapshot, model, tag);
+            uint64_t requests = threads / 2 * records / 2;
+            counted = counted && usage && (*usage)["requests"] == requests &&
+                      (*usage)["prompt_tokens"] == 2 * requests &&
+                      (*usage)["completion_tokens"] == requests &&
+                      (*usage)["total_tokens"] == 3 * requests;
+        }
+    }
+    check(counted, "merge: per model and tag counters add up");
+
+    accounting.reset();
+    snapshot = accounting.snapshot();
+    check(snapshot["total_tokens"] == 0 && snapshot["usage"].empty(), "merge: reset clears every shard");
+}
+
+void budgets() {
+    openai::Accounting accounting;
+    accounting.set_budget(100, 200, chrono::milliseconds(100));
+
+    double elapsed = milliseconds([&] { accounting.admit(); });
+    check(elapsed < 50, "budget: admitted at once under the soft budget");
+
+    accounting.record("gpt-4o", {{ "total_tokens", 150 }});
+    elapsed = milliseconds([&] { accounting.admit(); });
+    check(elapsed >= 100, "budget: delayed past the soft budget (" + to_string(int(elapsed)) + " ms)");
+
+    accounting.record("gpt-4o", {{ "total_tokens", 50 }});
+    bool rejected = false;
+    try {
+        accounting.admit();
+    } catch (const runtime_error&) {
+        rejected = true;
+    }
+    check(rejected, "budget: rejected at the hard budget");
+
+    accounting.reset();
+    elapsed = milliseconds([&] { accounting.admit(); });
+    check(elapsed < 50, "budget: admitted at once after reset");
+
+    accounting.record("gpt-4o", {{ "total_tokens", 1000 }});
+    accounting.set_budget(0, 0);
+    elapsed = milliseconds([&] { accounting.admit(); });
+    check(elapsed < 50, "budget: zero disables both budgets");
+}
+
+void instances() {
+    openai::Accounting survivor;
+
+    // every short-lived instance gets a shard on this thread; they must neither
+    // see each other's counts nor disturb the one that stays.
+    bool isolated = true;
+    for (int i = 0; i < 1000; i++) {
+        openai::Accounting accounting;
+        isolated = isolated && accounting.snapshot()["usage"].empty();
+        accounting.record("gpt-4o", {{ "total_tokens", 1 }});
+        survivor.record("gpt-4o", {{ "total_tokens", 1 }});
+        isolated = isolated && accounting.snapshot()["total_tokens"] == 1;
+    }
+    check(isolated, "instances: a new instance never sees a destroyed one's counts");
+
+    json snapshot = survivor.snapshot();
+    const json* usage = find_usage(snapshot, "gpt-4o", "");
+    check(usage && (*usage)["requests"] == 1000 && survivor.total_tokens() == 1000,
+          "instances: a long-lived instance keeps its shard");
+}
+
+void exports() {
+    openai::Accounting accounting;
+    accounting.record("gpt-4o", {{ "total_tokens", 5 }});
+
+    atomic<int> calls{0};
+    atomic<bool> seen{false};
+    accounting.export_every(chrono::milliseconds(20), [&](const json& snapshot) {
+        calls++;
+        if (snapshot["total_tokens"] == 5) seen = true;
+    });
+    this_thread::sleep_for(chrono::milliseconds(150));
+    accounting.stop_export();
+    int stopped = calls;
+    this_thread::sleep_for(chrono::milliseconds(60));
+
+    check(stopped >= 2 && seen, "export: snapshots delivered every interval");
+    check(calls == stopped, "export: nothing delivered after stop_export");
+}
+
+// a stream's usage comes in its last chunk; audio that happens to look like
+// events is never taken for it.
+void streams() {
+    const string events = "data: {\"choices\":[{\"delta\":{\"content\":\"hi\"}}]}\n\n"
+                          "data: {\"model\":\"gpt-4o\",\"choices\":[],\"usage\":{\"total_tokens\":7}}\n\n"
+                          "data: [DONE]\n\n";
+    json last_request;
+    mutex request_mutex;
+
+    Server server;
+    server.Post("/v1/chat/completions", [&](const Request& req, Response& res) {
+        {
+            lock_guard<mutex> lock(request_mutex);
+            last_request = json::parse(req.body);
+        }
+        res.set_content(events, "text/event-stream");
+    });
+    server.Post("/v1/audio/speech", [&](const Request&, Response& res) {
+        res.set_content(events, "audio/mpeg");
+    });
+    int port = server.bind_to_any_port("127.0.0.1");
+    thread listener([&] { server.listen_after_bind(); });
+    server.wait_until_ready();
+
+    {
+        openai::OpenAI openai("http://127.0.0.1:" + to_string(port));
+        json request = {{ "model", "gpt-4o" }, { "stream", true },
+                        { "messages", {{{ "role", "user" }, { "content", "hi" }}} }};
+
+        openai.audio.speech({{ "model", "tts-1" }, { "input", "hi" }, { "voice", "alloy" }});
+        check(openai.accounting().total_tokens() == 0, "stream: speech bodies are never scanned for usage");
+
+        openai.chat.create(request);
+        check(!last_request.contains("stream_options"), "stream: stream_options left alone by default");
+        check(openai.accounting().total_tokens() == 7, "stream: usage chunk of a chat stream counted");
+
+        openai.accounting().set_stream_usage(true);
+        openai.chat.create(request);
+        check(last_request["stream_options"] == json({{ "include_usage", true }}),
+              "stream: include_usage requested once enabled");
+
+        request["stream_options"] = {{ "include_usage", false }};
+        openai.chat.create(request);
+        check(last_request["stream_options"] == json({{ "include_usage", false }}),
+              "stream: the caller's stream_options win");
+    }
+
+    server.stop();
+    listener.join();
+}
+
+int main() {
+    merge();
+    budgets();
+    instances();
+    exports();
+    streams();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+static int failures = 0;
+
+void check(bool condition, const string& what) {
+    cout << (condition ? "ok      " : "FAILED  ") << what << endl;
+    if (!condition) failures++;
+}
+
+template <typename F>
+double milliseconds(F f) {
+    auto begin = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+int main() {
+    // /slow streams 20 chunks 100 ms apart, 2 s in all.
+    const chrono::milliseconds interval(100);
+    const int chunks = 20;
+
+    Server server;
+    server.Get("/slow", [&](const Request&, Response& res) {
+        res.set_chunked_content_provider("text/event-stream", [&, sent = 0](size_t, DataSink& sink) mutable {
+            if (sent == chunks) {
+                sink.done();
+                return true;
+            }
+            string chunk = "data: " + to_string(sent++) + "\n\n";
+            if (!sink.write(chunk.data(), chunk.size())) return false;
+            this_thread::sleep_for(interval);
+            return true;
+        });
+    });
+    server.Get("/stall", [&](const Request&, Response& res) {
+        this_thread::sleep_for(chrono::seconds(2));
+        res.set_content("{}", "application/json");
+    });
+    server.Get("/fast", [](const Request&, Response& res) {
+        res.set_content("{\"object\":\"list\"}", "application/json");
+    });
+    int port = server.bind_to_any_port("127.0.0.1");
+    thread listener([&] { server.listen_after_bind(); });
+    server.wait_until_ready();
+
+    // one session, used by one thread at a time, so every call below goes
+    // through the same pooled client.
+    openai::Session session("http://127.0.0.1:" + to_string(port));
+
+    {
+        openai::CancellationToken token;
+        openai::RequestOptions options;
+        options.cancellation = token;
+        atomic<int> received{0};
+        options.on_data = [&](const char*, size_t) {
+            received++;
+            return true;
+        };
+
+        thread canceller([&] {
+            while (received < 3) this_thread::sleep_for(chrono::milliseconds(1));
+            token.cancel();
+        });
+        int code = 0;
+        string error;
+        double elapsed = milliseconds([&] { tie(code, error) = session.get("/slow", options); });
+        canceller.join();
+
+        check(code != 0 && error == "Canceled", "cancel: mid-body cancel reports Canceled (" + error + ")");
+        check(received >= 3 && received < chunks, "cancel: stopped part way through the body");
+        check(elapsed < 1500, "cancel: returned well before the body ends (" + to_string(int(elapsed)) + " ms)");
+    }
+
+    {
+        int code = 0;
+        string body;
+        tie(code, body) = session.get("/fast");
+        check(code == 0 && body == "{\"object\":\"list\"}", "cancel: pooled client serves the next call");
+    }
+
+    {
+        openai::RequestOptions options;
+        options.deadline = chrono::steady_clock::now() + chrono::milliseconds(350);
+        options.on_data = [](const char*, size_t) { return true; };
+        int code = 0;
+        string error;
+        double elapsed = milliseconds([&] { tie(code, error) = session.get("/slow", options); });
+
+        check(code != 0 && error == "Deadline exceeded", "deadline: mid-body deadline reported (" + error + ")");
+        check(elapsed < 1000, "deadline: returned near the deadline (" + to_string(int(elapsed)) + " ms)");
+    }
+
+    {
+        openai::RequestOptions options;
+        options.deadline = chrono::steady_clock::now() + chrono::milliseconds(300);
+        int code = 0;
+        string error;
+        double elapsed = milliseconds([&] { tie(code, error) = session.get("/stall", options); });
+
+        check(code != 0 && error == "Deadline exceeded", "deadline: deadline before the headers reported (" + error + ")");
+        check(elapsed < 1000, "deadline: read timeout capped by the deadline (" + to_string(int(elapsed)) + " ms)");
+    }
+
+    {
+        openai::RequestOptions options;
+        options.read_timeout = chrono::milliseconds(200);
+        int code = 0;
+        string error;
+        tie(code, error) = session.get("/stall", options);
+        check(code != 0 && error != "Deadline exceeded" && error != "Canceled", "timeout: read timeout reported as such (" + error + ")");
+    }
+
+    {
+        int code = 0;
+        string body;
+        tie(code, body) = session.get("/fast");
+        check(code == 0 && body == "{\"object\":\"list\"}", "deadline: pooled client serves the next call");
+    }
+
+    {
+        openai::CancellationToken token;
+        token.cancel();
+        openai::RequestOptions options;
+        options.cancellation = token;
+        int code = 0;
+        string error;
+        tie(code, error) = session.get("/fast", options);
+        check(code != 0 && error == "Canceled", "cancel: an already cancelled token never sends");
+    }
+
+    server.stop();
+    listener.join();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+static int failures = 0;
+
+void check(bool condition, const string& what) {
+    cout << (condition ? "ok      " : "FAILED  ") << what << endl;
+    if (!condition) failures++;
+}
+
+int main() {
+    // the completion streams 10 chunks 50 ms apart; moderation answers after
+    // 150 ms, so its verdict always lands in the middle of the stream.
+    const int chunks = 10;
+    const chrono::milliseconds interval(50);
+    string stream;
+    for (int i = 0; i < chunks; i++) {
+        stream += "data: {\"choices\":[{\"delta\":{\"content\":\"" + to_string(i) + "\"}}]}\n\n";
+    }
+    stream += "data: [DONE]\n\n";
+
+    Server server;
+    server.Post("/v1/chat/completions", [&](const Request&, Response& res) {
+        res.set_chunked_content_provider("text/event-stream", [&, sent = 0](size_t, DataSink& sink) mutable {
+            if (sent == chunks) {
+                string done = "data: [DONE]\n\n";
+                sink.write(done.data(), done.size());
+                sink.done();
+                return true;
+            }
+            string chunk = "data: {\"choices\":[{\"delta\":{\"content\":\"" + to_string(sent++) + "\"}}]}\n\n";
+            if (!sink.write(chunk.data(), chunk.size())) return false;
+            this_thread::sleep_for(interval);
+            return true;
+        });
+    });
+    server.Post("/v1/moderations", [&](const Request& req, Response& res) {
+        this_thread::sleep_for(chrono::milliseconds(150));
+        string input = json::parse(req.body)["input"].dump();
+        if (input.find("fail") != string::npos) {
+            res.status = 500;
+            res.set_content("{\"error\":{\"message\":\"unavailable\"}}", "application/json");
+            return;
+        }
+        bool flagged = input.find("harmful") != string::npos;
+        res.set_content(json({
+            { "model", "omni-moderation-latest" },
+            { "results", {{{ "flagged", flagged }}} },
+            { "usage", {{ "total_tokens", 1 }} }
+        }).dump(), "application/json");
+    });
+    int port = server.bind_to_any_port("127.0.0.1");
+    thread listener([&] { server.listen_after_bind(); });
+    server.wait_until_ready();
+
+    auto request = [](const string& content) {
+        return json({
+            { "model", "gpt-4o" },
+            { "stream", true },
+            { "messages", {{{ "role", "user" }, { "content", content }}} }
+        });
+    };
+
+    {
+        openai::OpenAI openai("http://127.0.0.1:" + to_string(port));
+        string received;
+        openai::RequestOptions options;
+        options.on_data = [&](const char* data, size_t length) {
+            received.append(data, length);
+            return true;
+        };
+
+        {
+            openai::UsageTag tag("tenant");
+            openai.chat.create_gated(request("hello"), options);
+        }
+        check(received == stream, "clean: on_data gets the whole stream");
+
+        json usage = openai.accounting().snapshot()["usage"];
+        bool tagged = false;
+        for (auto& entry: usage) {
+            tagged = tagged || (entry["model"] == "omni-moderation-latest" && entry["tag"] == "tenant");
+        }
+        check(tagged, "clean: moderation usage carries the caller's tag");
+
+        received.clear();
+        bool thrown = false;
+        bool flagged = false;
+        auto begin = chrono::steady_clock::now();
+        try {
+            openai.chat.create_gated(request("something harmful"), options);
+        } catch (const openai::ModerationError& e) {
+            thrown = true;
+            flagged = e.flagged() && e.verdict()["results"][0]["flagged"] == true;
+        }
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        check(thrown && flagged, "flagged: ModerationError carries the verdict");
+        check(received.empty(), "flagged: on_data gets zero bytes (" + to_string(received.size()) + ")");
+        check(elapsed < chunks * interval.count(), "flagged: the completion is stopped early (" +
+                                                   to_string(int(elapsed)) + " ms)");
+
+        thrown = false;
+        flagged = true;
+        try {
+            openai.chat.create_gated(request("fail the moderation call"), options);
+        } catch (const openai::ModerationError& e) {
+            thrown = true;
+            flagged = e.flagged();
+        }
+        check(thrown && !flagged, "failed: a moderation call that fails throws as well");
+        check(received.empty(), "failed: on_data gets zero bytes");
+    }
+
+    server.stop();
+    listener.join();
+
+    return failures ? 1 : 0;
+}
@@ -1,5 +1,12 @@
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <algorithm>
 #include <boost/program_options.hpp>
 
 #include "../include/openai.h"
@@ -16,11 +23,239 @@ void usage(const string& name, const po::options_description& opts) {
          << " [--base-uri scheme://host:port]"
          << " [--token token]"
          << " [--proxy host:port]"
+         << endl
+         << name << " --batch requests.jsonl [--workers n] [--output results.jsonl] [--order input|completion] [--timeout ms]"
          << endl << endl
          <<"options: " << endl
          << opts << endl;
 }
 
+// one record of a batch run: {"endpoint": "/v1/...", "body": {...}} with an optional
+// "method" of GET, POST or DELETE (POST when omitted, GET when there is no body).
+struct BatchJob {
+    size_t index;
+    string line;
+};
+
+struct BatchResult {
+    size_t index;
+    string line;
+    double latency_ms;
+    bool ok;
+};
+
+class BatchWriter {
+    ostream& os_;
+    bool ordered_;
+    size_t window_;
+
+    mutex mutex_;
+    condition_variable cv_;
+    map<size_t, string> pending_;
+    size_t next_ = 0;
+
+    public:
+        BatchWriter(ostream& os, bool ordered, size_t window) : 
+            os_{os}, ordered_{ordered}, window_{window} {}
+
+        // blocks the reader while too many results are parked behind a slow one,
+        // so input order never costs more than a bounded amount of memory.
+        void admit(size_t index) {
+            if (!ordered_) return;
+            unique_lock<mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return index < next_ + window_; });
+        }
+
+        void write(size_t index, const string& line) {
+            lock_guard<mutex> lock(mutex_);
+            if (!ordered_) {
+                os_ << line << '\n';
+                return;
+            }
+
+            pending_[index] = line;
+            while (!pending_.empty() && pending_.begin()->first == next_) {
+                os_ << pending_.begin()->second << '\n';
+                pending_.erase(pending_.begin());
+                next_++;
+            }
+            cv_.notify_all();
+        }
+};
+
+class BatchQueue {
+    size_t capacity_;
+
+    mutex mutex_;
+    condition_variable not_empty_;
+    condition_variable not_full_;
+    deque<BatchJob> jobs_;
+    bool closed_ = false;
+
+    public:
+        BatchQueue(size_t capacity) : 
+            capacity_{capacity} {}
+
+        void push(BatchJob job) {
+            unique_lock<mutex> lock(mutex_);
+            not_full_.wait(lock, [&] { return jobs_.size() < capacity_; });
+            jobs_.push_back(move(job));
+            not_empty_.notify_one();
+        }
+
+        bool pop(BatchJob& job) {
+            unique_lock<mutex> lock(mutex_);
+            not_empty_.wait(lock, [&] { return closed_ || !jobs_.empty(); });
+            if (jobs_.empty()) return false;
+            job = move(jobs_.front());
+            jobs_.pop_front();
+            not_full_.notify_one();
+            return true;
+        }
+
+        void close() {
+            lock_guard<mutex> lock(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+        }
+};
+
+BatchResult run_batch_job(const BatchJob& job, chrono::milliseconds timeout) {
+    BatchResult result{job.index, "", 0.0, false};
+    json out = {{ "index", job.index }};
+
+    auto begin = chrono::steady_clock::now();
+    openai::RequestOptions options;
+    if (timeout.count() > 0) {
+        options.deadline = begin + timeout;
+    }
+
+    try {
+        json record = json::parse(job.line);
+        string endpoint = record.at("endpoint").get<string>();
+        string method = record.contains("method") ? record["method"].get<string>() : 
+                        record.contains("body") ? "POST" : "GET";
+        out["endpoint"] = endpoint;
+
+        json response;
+        if (method == "GET") {
+            response = openai::instance().get(endpoint, options);
+        } else if (method == "DELETE") {
+            response = openai::instance().del(endpoint, options);
+        } else if (method == "POST") {
+            response = openai::instance().post(endpoint, 
+                                               record.contains("body") ? record["body"].dump() : "", 
+                                               "application/json", 
+                                               options);
+        } else {
+            throw runtime_error("unsupported method: " + method);
+        }
+
+        out["response"] = move(response);
+        result.ok = true;
+    } catch (const exception& e) {
+        out["error"] = e.what();
+    }
+    result.latency_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+
+    out["latency_ms"] = result.latency_ms;
+    result.line = out.dump();
+    return result;
+}
+
+int run_batch(const string& input, 
+              const string& output, 
+              size_t workers, 
+              bool ordered, 
+              chrono::milliseconds timeout) {
+    ifstream is(input);
+    if (!is.is_open()) {
+        cout << "can not open " << input << endl;
+        return 1;
+    }
+
+    ofstream ofs;
+    if (!output.empty()) {
+        ofs.open(output);
+        if (!ofs.is_open()) {
+            cout << "can not open " << output << endl;
+            return 1;
+        }
+    }
+    ostream& os = output.empty() ? cout : ofs;
+
+    BatchQueue queue(workers * 4);
+    BatchWriter writer(os, ordered, workers * 64);
+
+    mutex stats_mutex;
+    vector<double> latencies;
+    size_t failed = 0;
+
+    auto begin = chrono::steady_clock::now();
+
+    vector<thread> pool;
+    for (size_t i = 0; i < workers; i++) {
+        pool.emplace_back([&] {
+            BatchJob job;
+            while (queue.pop(job)) {
+                BatchResult result = run_batch_job(job, timeout);
+                writer.write(result.index, result.line);
+
+                lock_guard<mutex> lock(stats_mutex);
+                latencies.push_back(result.latency_ms);
+                if (!result.ok) failed++;
+            }
+        });
+    }
+
+    size_t index = 0;
+    string line;
+    while (getline(is, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+        writer.admit(index);
+        queue.push({index++, move(line)});
+    }
+    queue.close();
+
+    for (auto& t: pool) {
+        t.join();
+    }
+    os.flush();
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        if (latencies.empty()) return 0.0;
+        return latencies[min(latencies.size() - 1, (size_t)(p * latencies.size()))];
+    };
+    double total = 0.0;
+    for (auto l: latencies) total += l;
+
+    cerr << "requests: " << latencies.size() 
+         << " ok: " << latencies.size() - failed 
+         << " failed: " << failed << endl
+         << "elapsed: " << elapsed << " s" 
+         << " throughput: " << (elapsed > 0 ? latencies.size() / elapsed : 0.0) << " req/s" << endl
+         << "latency ms: mean " << (latencies.empty() ? 0.0 : total / latencies.size())
+         << " p50 " << percentile(0.50)
+         << " p90 " << percentile(0.90)
+         << " p99 " << percentile(0.99)
+         << " max " << (latencies.empty() ? 0.0 : latencies.back()) << endl;
+    if (openai::instance().single_flight().enabled()) {
+        cerr << "single-flight: upstream " << openai::instance().single_flight().calls()
+             << " coalesced " << openai::instance().single_flight().coalesced() << endl;
+    }
+    for (auto& usage: openai::accounting().snapshot()["usage"]) {
+        cerr << "usage: " << usage["model"].get<string>()
+             << " requests " << usage["requests"]
+             << " prompt " << usage["prompt_tokens"]
+             << " completion " << usage["completion_tokens"]
+             << " total " << usage["total_tokens"] << endl;
+    }
+
+    return 0;
+}
+
 int main(int argc, char * argv[]) {
     po::options_description opts;
     opts.add_options()
@@ -62,7 +297,15 @@ int main(int argc, char * argv[]) {
                                )
                     ("edit", "[--images] creates an edited or extended image given an original image and a prompt.")
                     ("variation", "[--images] creates a variation of a given image.")
+                    ("gated", "[--chat --create] moderate the user messages while the completion runs, and only return it once they pass.")
                     ("data,d", po::value<string>(), "body of the request.")
+                    ("batch", po::value<string>(), "run every {endpoint, body} record of a jsonl file and write the results as jsonl.")
+                    ("workers", po::value<size_t>()->default_value(8), "[--batch] number of concurrent requests.")
+                    ("output,o", po::value<string>()->default_value(""), "[--batch] result file, stdout when empty.")
+                    ("order", po::value<string>()->default_value("input"), "[--batch] write results in input or completion order.")
+                    ("timeout", po::value<int>()->default_value(0), "[--batch] deadline of each request in milliseconds, 0 for none.")
+                    ("budget", po::value<uint64_t>()->default_value(0), "reject requests once this many tokens are used, slow them down over the last tenth. 0 for none.")
+                    ("single-flight", "share one upstream call between identical requests that are in flight at the same time.")
                     ;
     
     po::variables_map vm;
@@ -77,7 +320,25 @@ int main(int argc, char * argv[]) {
         openai::start(vm["base-uri"].as<string>(), 
                       vm["token"].as<string>(), 
                       vm["proxy"].as<string>());
-        if (vm.count("audio") > 0) {
+
+        if (vm.count("single-flight") > 0) {
+            openai::instance().set_single_flight(true);
+        }
+
+        if (vm["budget"].as<uint64_t>() > 0) {
+            uint64_t budget = vm["budget"].as<uint64_t>();
+            openai::accounting().set_budget(budget - budget / 10, budget);
+            // streamed chats count against the budget too; the usage chunk is printed with the rest.
+            openai::accounting().set_stream_usage(true);
+        }
+
+        if (vm.count("batch") > 0) {
+            return run_batch(vm["batch"].as<string>(), 
+                             vm["output"].as<string>(), 
+                             max<size_t>(1, vm["workers"].as<size_t>()), 
+                             vm["order"].as<string>() != "completion", 
+                             chrono::milliseconds(vm["timeout"].as<int>()));
+        } else if (vm.count("audio") > 0) {
             if (vm.count("speech") > 0) {
                 if (vm.count("data") > 0) {
                     ifstream is(vm["data"].as<string>());
@@ -127,8 +388,14 @@ int main(int argc, char * argv[]) {
                         stringstream data;
                         data << is.rdbuf();
                         cout << "data: "  << endl << data.str() << endl;
-                        json response = openai::chat().create(json::parse(data.str()));
-                        cout << response.dump() << endl;
+                        try {
+                            json response = vm.count("gated") > 0 ? 
+                                            openai::chat().create_gated(json::parse(data.str())) : 
+                                            openai::chat().create(json::parse(data.str()));
+                            cout << response.dump() << endl;
+                        } catch (const openai::ModerationError& e) {
+                            cout << "moderation: " << e.what() << endl << e.verdict().dump() << endl;
+                        }
                     }
                 }
             }
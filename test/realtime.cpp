@@ -0,0 +1,346 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <cctype>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+static int failures = 0;
+
+void check(bool condition, const string& what) {
+    cout << (condition ? "ok      " : "FAILED  ") << what << endl;
+    if (!condition) failures++;
+}
+
+// a single-connection websocket server standing in for the realtime endpoint.
+// it speaks just enough of RFC 6455 to check what the client puts on the wire.
+class StandIn {
+    int listener_ = -1;
+    int client_ = -1;
+    int port_ = 0;
+    string input_;
+
+    bool fill(size_t size) {
+        while (input_.size() < size) {
+            char buffer[16384];
+            ssize_t n = ::recv(client_, buffer, sizeof(buffer), 0);
+            if (n <= 0) return false;
+            input_.append(buffer, size_t(n));
+        }
+        return true;
+    }
+
+    public:
+        StandIn() {
+            listener_ = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0;
+            socklen_t length = sizeof(address);
+            if (::bind(listener_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                ::listen(listener_, 1) != 0 ||
+                ::getsockname(listener_, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+                throw runtime_error("stand-in can not listen");
+            }
+            port_ = ntohs(address.sin_port);
+        }
+
+        ~StandIn() {
+            if (client_ >= 0) ::close(client_);
+            ::close(listener_);
+        }
+
+        int port() const { return port_; }
+
+        // reads the upgrade request and answers it. header names are lower cased,
+        // the request line is stored under "".
+        map<string, string> accept(bool valid_key = true) {
+            client_ = ::accept(listener_, nullptr, nullptr);
+            timeval tv = { 5, 0 };
+            setsockopt(client_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+            size_t end;
+            while ((end = input_.find("\r\n\r\n")) == string::npos) {
+                if (!fill(input_.size() + 1)) return {};
+            }
+            string head = input_.substr(0, end);
+            input_.erase(0, end + 4);
+
+            map<string, string> headers;
+            size_t begin = 0;
+            while (begin <= head.size()) {
+                size_t eol = head.find("\r\n", begin);
+                string line = head.substr(begin, eol == string::npos ? string::npos : eol - begin);
+                size_t colon = line.find(": ");
+                if (begin == 0) {
+                    headers[""] = line;
+                } else if (colon != string::npos) {
+                    string name = line.substr(0, colon);
+                    for (auto& c: name) c = char(tolower(c));
+                    headers[name] = line.substr(colon + 2);
+                }
+                if (eol == string::npos) break;
+                begin = eol + 2;
+            }
+
+            string accept = headers["sec-websocket-key"] + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+            unsigned char digest[SHA_DIGEST_LENGTH];
+            SHA1(reinterpret_cast<const unsigned char*>(accept.data()), accept.size(), digest);
+            accept = openai::base64_encode(reinterpret_cast<const char*>(digest), sizeof(digest));
+            if (!valid_key) {
+                accept = openai::base64_encode("not the accept key", 18);
+            }
+
+            string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Accept: " + accept + "\r\n\r\n";
+            ::send(client_, response.data(), response.size(), 0);
+            return headers;
+        }
+
+        // server frames are never masked.
+        void send(int opcode, const string& payload) {
+            string frame;
+            frame += char(0x80 | opcode);
+            if (payload.size() < 126) {
+                frame += char(payload.size());
+            } else if (payload.size() <= 0xffff) {
+                frame += char(126);
+                frame += char((payload.size() >> 8) & 0xff);
+                frame += char(payload.size() & 0xff);
+            } else {
+                frame += char(127);
+                for (int shift = 56; shift >= 0; shift -= 8) {
+                    frame += char((uint64_t(payload.size()) >> shift) & 0xff);
+                }
+            }
+            frame += payload;
+            ::send(client_, frame.data(), frame.size(), 0);
+        }
+
+        // reads one frame; client frames must be masked and unfragmented here.
+        bool receive(int& opcode, string& payload, bool& masked) {
+            if (!fill(2)) return false;
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(input_.data());
+            opcode = p[0] & 0x0f;
+            masked = p[1] & 0x80;
+            uint64_t length = p[1] & 0x7f;
+            size_t header = 2;
+            if (length == 126) {
+                if (!fill(4)) return false;
+                p = reinterpret_cast<const unsigned char*>(input_.data());
+                length = (uint64_t(p[2]) << 8) | p[3];
+                header = 4;
+            } else if (length == 127) {
+                if (!fill(10)) return false;
+                p = reinterpret_cast<const unsigned char*>(input_.data());
+                length = 0;
+                for (int i = 0; i < 8; i++) length = (length << 8) | p[2 + i];
+                header = 10;
+            }
+            size_t key = header;
+            if (masked) header += 4;
+            if (!fill(header + length)) return false;
+
+            payload = input_.substr(header, size_t(length));
+            if (masked) {
+                for (size_t i = 0; i < payload.size(); i++) payload[i] ^= input_[key + (i & 3)];
+            }
+            input_.erase(0, header + size_t(length));
+            return true;
+        }
+
+        // skips control frames, returns the next text event.
+        json event() {
+            int opcode;
+            string payload;
+            bool masked;
+            while (receive(opcode, payload, masked)) {
+                if (opcode == openai::WebSocket::text) return json::parse(payload);
+            }
+            return json();
+        }
+};
+
+void handshake() {
+    StandIn server;
+    map<string, string> headers;
+    json first;
+    thread peer([&] {
+        headers = server.accept();
+        first = server.event();
+    });
+
+    openai::OpenAI openai("http://127.0.0.1:" + to_string(server.port()), "sk-test");
+    auto realtime = openai.realtime.connect("gpt-4o-realtime-preview", {{ "voice", "alloy" }});
+    peer.join();
+
+    check(headers[""] == "GET /v1/realtime?model=gpt-4o-realtime-preview HTTP/1.1", "handshake: request line");
+    check(headers["upgrade"] == "websocket" && headers["connection"] == "Upgrade", "handshake: upgrade headers");
+    check(headers["sec-websocket-version"] == "13", "handshake: version 13");
+    check(openai::base64_decode(headers["sec-websocket-key"]).size() == 16, "handshake: 16 byte key");
+    check(headers["authorization"] == "Bearer sk-test", "handshake: bearer token");
+    check(headers["openai-beta"] == "realtime=v1", "handshake: beta header");
+    check(first.value("type", "") == "session.update" && first["session"]["voice"] == "alloy",
+          "handshake: session configuration sent first");
+    realtime->close();
+
+    StandIn impostor;
+    thread refused([&] { impostor.accept(false); });
+    bool thrown = false;
+    try {
+        openai::OpenAI other("http://127.0.0.1:" + to_string(impostor.port()));
+        other.realtime.connect("gpt-4o-realtime-preview");
+    } catch (const exception&) {
+        thrown = true;
+    }
+    refused.join();
+    check(thrown, "handshake: wrong accept key refused");
+}
+
+void audio_order() {
+    const size_t count = 48000;
+    vector<int16_t> samples(count);
+    for (size_t i = 0; i < count; i++) samples[i] = int16_t(i * 31);
+
+    StandIn server;
+    vector<string> types;
+    string received;
+    bool all_masked = true;
+    int close_opcode = -1;
+    string close_payload;
+    thread peer([&] {
+        server.accept();
+        for (;;) {
+            int opcode;
+            string payload;
+            bool masked;
+            if (!server.receive(opcode, payload, masked)) break;
+            all_masked = all_masked && masked;
+            if (opcode == openai::WebSocket::close) {
+                close_opcode = opcode;
+                close_payload = payload;
+                break;
+            }
+            if (opcode != openai::WebSocket::text) continue;
+
+            json event = json::parse(payload);
+            string type = event.value("type", "");
+            types.push_back(type);
+            if (type == "input_audio_buffer.append") {
+                received += openai::base64_decode(event["audio"].get<string>());
+            } else if (type == "input_audio_buffer.commit") {
+                // plays the committed audio back, as a response would.
+                server.send(openai::WebSocket::text, json({
+                    { "type", "response.audio.delta" },
+                    { "delta", openai::base64_encode(received.data(), received.size()) }
+                }).dump());
+            }
+        }
+    });
+
+    openai::OpenAI openai("http://127.0.0.1:" + to_string(server.port()));
+    auto realtime = openai.realtime.connect("gpt-4o-realtime-preview");
+
+    realtime->update({{ "input_audio_format", "pcm16" }});
+    // written in 10 ms slices, as an audio callback would.
+    for (size_t i = 0; i < count; i += 240) {
+        realtime->write_audio(samples.data() + i, min<size_t>(240, count - i));
+    }
+    realtime->commit_audio();
+
+    vector<int16_t> played(count);
+    size_t read = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (read < count && chrono::steady_clock::now() < deadline) {
+        read += realtime->read_audio(played.data() + read, count - read);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    realtime->close();
+    peer.join();
+
+    size_t commit = find(types.begin(), types.end(), "input_audio_buffer.commit") - types.begin();
+    size_t appends = count_if(types.begin(), types.begin() + min(commit, types.size()),
+                              [](const string& type) { return type == "input_audio_buffer.append"; });
+    check(!types.empty() && types.front() == "session.update", "audio: update sent before audio written after it");
+    check(commit < types.size(), "audio: commit received");
+    check(appends > 0 && appends == commit - 1, "audio: every append arrives before the commit");
+    check(received.size() == count * sizeof(int16_t) &&
+          memcmp(received.data(), samples.data(), received.size()) == 0, "audio: samples arrive intact and in order");
+    check(read == count && played == samples, "audio: played back samples read from the output ring");
+    check(all_masked, "audio: every client frame masked");
+    check(close_opcode == openai::WebSocket::close && close_payload == string("\x03\xe8", 2),
+          "audio: close() sends close 1000");
+}
+
+void ping_close() {
+    StandIn server;
+    string pong;
+    int pong_opcode = -1;
+    string close_echo;
+    int close_opcode = -1;
+    // the peer waits for the client's handlers, so the close can't beat them.
+    atomic<bool> ready{false};
+    thread peer([&] {
+        server.accept();
+        while (!ready) this_thread::sleep_for(chrono::milliseconds(1));
+        server.send(openai::WebSocket::ping, "are you there");
+        int opcode;
+        string payload;
+        bool masked;
+        while (server.receive(opcode, payload, masked)) {
+            if (opcode == openai::WebSocket::pong) {
+                pong_opcode = opcode;
+                pong = payload;
+                break;
+            }
+        }
+
+        server.send(openai::WebSocket::close, string("\x03\xe9", 2) + "going away");
+        while (server.receive(opcode, payload, masked)) {
+            if (opcode == openai::WebSocket::close) {
+                close_opcode = opcode;
+                close_echo = payload;
+                break;
+            }
+        }
+    });
+
+    openai::OpenAI openai("http://127.0.0.1:" + to_string(server.port()));
+    auto realtime = openai.realtime.connect("gpt-4o-realtime-preview");
+    atomic<bool> closed{false};
+    atomic<bool> nested{false};
+    realtime->on("close", [&](const json&) {
+        closed = true;
+        // registering from inside a handler must not deadlock.
+        realtime->on("close", [&](const json&) { nested = true; });
+    });
+    ready = true;
+
+    peer.join();
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (realtime->running() && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    check(pong_opcode == openai::WebSocket::pong && pong == "are you there", "ping: answered with the same payload");
+    check(close_opcode == openai::WebSocket::close && close_echo == string("\x03\xe9", 2),
+          "close: peer close echoed with its status code");
+    check(closed, "close: close event dispatched");
+    check(!nested, "close: handler added during dispatch runs from the next event on");
+    check(!realtime->running(), "close: session stopped");
+    realtime->close();
+}
+
+int main() {
+    handshake();
+    audio_order();
+    ping_close();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+
+#include "../include/openai.h"
+
+using namespace std;
+
+static int failures = 0;
+
+void check(bool condition, const string& what) {
+    cout << (condition ? "ok      " : "FAILED  ") << what << endl;
+    if (!condition) failures++;
+}
+
+// starts n threads together and waits for all of them.
+template <typename F>
+void together(size_t n, F f) {
+    atomic<bool> go{false};
+    vector<thread> threads;
+    for (size_t i = 0; i < n; i++) {
+        threads.emplace_back([&] {
+            while (!go) this_thread::yield();
+            f();
+        });
+    }
+    go = true;
+    for (auto& t: threads) t.join();
+}
+
+int main() {
+    const size_t threads = 32;
+    // long enough for every thread to join the flight before the leader returns.
+    const chrono::milliseconds delay(300);
+
+    atomic<int> upstream_posts{0};
+    atomic<int> upstream_gets{0};
+    atomic<int> upstream_failures{0};
+
+    Server server;
+    server.Post("/v1/chat/completions", [&](const Request&, Response& res) {
+        upstream_posts++;
+        this_thread::sleep_for(delay);
+        res.set_content("{\"object\":\"chat.completion\",\"choices\":[]}", "application/json");
+    });
+    server.Get("/v1/models", [&](const Request&, Response& res) {
+        upstream_gets++;
+        this_thread::sleep_for(delay);
+        res.set_content("{\"object\":\"list\",\"data\":[]}", "application/json");
+    });
+    server.Post("/v1/embeddings", [&](const Request&, Response& res) {
+        upstream_failures++;
+        this_thread::sleep_for(delay);
+        res.status = 500;
+        res.set_content("{}", "application/json");
+    });
+    int port = server.bind_to_any_port("127.0.0.1");
+    thread listener([&] { server.listen_after_bind(); });
+    server.wait_until_ready();
+
+    string base_uri = "http://127.0.0.1:" + to_string(port);
+
+    {
+        openai::OpenAI openai(base_uri);
+        openai.set_single_flight(true);
+        atomic<int> ok{0};
+        together(threads, [&] {
+            json response = openai.post("/v1/chat/completions", "{\"model\":\"gpt-4o\"}");
+            if (response.value("object", "") == "chat.completion") ok++;
+        });
+        check(openai.single_flight().calls() == 1, "post: one upstream call");
+        check(openai.single_flight().coalesced() == threads - 1, "post: every other caller coalesced");
+        check(openai.single_flight().in_flight() == 0, "post: no flight left behind");
+        check(upstream_posts == 1, "post: server saw one request");
+        check(ok == (int)threads, "post: every caller got the response");
+    }
+
+    {
+        openai::OpenAI openai(base_uri);
+        openai.set_single_flight(true);
+        together(threads, [&] { openai.get("/v1/models"); });
+        check(openai.single_flight().calls() == 1, "get: one upstream call");
+        check(openai.single_flight().coalesced() == threads - 1, "get: every other caller coalesced");
+        check(openai.single_flight().in_flight() == 0, "get: no flight left behind");
+        check(upstream_gets == 1, "get: server saw one request");
+    }
+
+    {
+        openai::OpenAI openai(base_uri);
+        openai.set_single_flight(true);
+        atomic<int> thrown{0};
+        together(threads, [&] {
+            try {
+                openai.post("/v1/embeddings", "{\"model\":\"text-embedding-3-small\"}");
+            } catch (const exception&) {
+                thrown++;
+            }
+        });
+        check(openai.single_flight().calls() == 1, "error: one upstream call");
+        check(openai.single_flight().coalesced() == threads - 1, "error: every other caller coalesced");
+        check(openai.single_flight().in_flight() == 0, "error: no flight left behind");
+        check(upstream_failures == 1, "error: server saw one request");
+        check(thrown == (int)threads, "error: every caller saw the failure");
+    }
+
+    server.stop();
+    listener.join();
+
+    return failures ? 1 : 0;
+}
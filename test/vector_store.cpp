@@ -0,0 +1,199 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <set>
+#include <cstdio>
+
+#include "../include/vector_store.h"
+
+using namespace std;
+
+static int failures = 0;
+
+void check(bool condition, const string& what) {
+    cout << (condition ? "ok      " : "FAILED  ") << what << endl;
+    if (!condition) failures++;
+}
+
+using aligned_floats = vector<float, openai::AlignedAllocator<float>>;
+using aligned_int8 = vector<int8_t, openai::AlignedAllocator<int8_t>>;
+
+bool close_to(float a, float b) {
+    return fabs(a - b) <= 1e-4f * max(1.0f, max(fabs(a), fabs(b)));
+}
+
+void kernels() {
+    mt19937 rng(7);
+    normal_distribution<float> normal;
+    uniform_int_distribution<int> byte(-127, 127);
+
+    const size_t n = 1536;
+    aligned_floats a(n), b(n);
+    aligned_int8 q(n);
+    for (size_t i = 0; i < n; i++) {
+        a[i] = normal(rng);
+        b[i] = normal(rng);
+        q[i] = int8_t(byte(rng));
+    }
+
+    float dot = openai::kernels::dot_scalar(a.data(), b.data(), n);
+    float dot_i8 = openai::kernels::dot_i8_scalar(a.data(), q.data(), n);
+
+#ifdef OPENAI_VECTOR_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        check(close_to(openai::kernels::dot_avx2(a.data(), b.data(), n), dot), "kernels: avx2 dot matches scalar");
+        check(close_to(openai::kernels::dot_i8_avx2(a.data(), q.data(), n), dot_i8), "kernels: avx2 int8 dot matches scalar");
+    } else {
+        cout << "skipped kernels: no avx2 on this cpu" << endl;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        check(close_to(openai::kernels::dot_avx512(a.data(), b.data(), n), dot), "kernels: avx512 dot matches scalar");
+        check(close_to(openai::kernels::dot_i8_avx512(a.data(), q.data(), n), dot_i8), "kernels: avx512 int8 dot matches scalar");
+    } else {
+        cout << "skipped kernels: no avx512 on this cpu" << endl;
+    }
+#endif
+    check(close_to(openai::kernels::select_dot()(a.data(), b.data(), n), dot),
+          string("kernels: selected ") + openai::kernels::isa() + " dot matches scalar");
+}
+
+// rows drawn around a few centers, queries are noisy copies of known rows.
+struct Corpus {
+    size_t dims = 256;
+    vector<vector<float>> rows;
+    vector<vector<float>> queries;
+    vector<size_t> sources;
+
+    Corpus(size_t count, size_t query_count) {
+        mt19937 rng(42);
+        normal_distribution<float> normal;
+        vector<vector<float>> centers(16, vector<float>(dims));
+        for (auto& center: centers) {
+            for (auto& x: center) x = normal(rng);
+        }
+        for (size_t i = 0; i < count; i++) {
+            vector<float> row = centers[i % centers.size()];
+            for (auto& x: row) x += 0.5f * normal(rng);
+            rows.push_back(move(row));
+        }
+        for (size_t i = 0; i < query_count; i++) {
+            size_t source = (i * 7919) % count;
+            vector<float> query = rows[source];
+            for (auto& x: query) x += 0.05f * normal(rng);
+            queries.push_back(move(query));
+            sources.push_back(source);
+        }
+    }
+};
+
+bool same_hits(const vector<vector<openai::SearchHit>>& a, const vector<vector<openai::SearchHit>>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].size() != b[i].size()) return false;
+        for (size_t j = 0; j < a[i].size(); j++) {
+            if (a[i][j].id != b[i][j].id || a[i][j].score != b[i][j].score) return false;
+        }
+    }
+    return true;
+}
+
+void search(const Corpus& corpus) {
+    const size_t k = 10;
+
+    openai::VectorStore exact(corpus.dims);
+    for (auto& row: corpus.rows) exact.add(row);
+    openai::VectorStore quantized(corpus.dims);
+    for (auto& row: corpus.rows) quantized.add(row);
+    quantized.quantize();
+
+    auto expected = exact.search(corpus.queries, k, 4);
+    auto approximate = quantized.search(corpus.queries, k, 4);
+
+    size_t top1 = 0, sources = 0, overlap = 0;
+    for (size_t i = 0; i < corpus.queries.size(); i++) {
+        if (expected[i][0].id == corpus.sources[i]) sources++;
+        if (approximate[i][0].id == expected[i][0].id) top1++;
+        set<size_t> ids;
+        for (auto& hit: expected[i]) ids.insert(hit.id);
+        for (auto& hit: approximate[i]) overlap += ids.count(hit.id);
+    }
+    double recall = double(overlap) / double(corpus.queries.size() * k);
+
+    check(sources == corpus.queries.size(), "search: float top-1 is the query's source row");
+    check(top1 == corpus.queries.size(), "search: int8 top-1 matches float top-1");
+    check(recall >= 0.9, "search: int8 top-10 recall against float " + to_string(recall));
+    check(same_hits({exact.search(corpus.queries[0], k)}, {expected[0]}), "search: batch matches single query");
+}
+
+void round_trip(const Corpus& corpus) {
+    const size_t k = 5;
+    for (bool quantize: { false, true }) {
+        string name = quantize ? "int8" : "float";
+        string path = "vector_store_test_" + name + ".bin";
+
+        openai::VectorStore store(corpus.dims, openai::Metric::dot);
+        for (auto& row: corpus.rows) store.add(row);
+        if (quantize) store.quantize();
+        store.save(path);
+
+        openai::VectorStore mapped = openai::VectorStore::open(path);
+        check(mapped.mapped() && mapped.size() == store.size() && mapped.dims() == store.dims() &&
+              mapped.quantized() == quantize && mapped.metric() == openai::Metric::dot,
+              "round trip: " + name + " header survives");
+        check(same_hits(mapped.search(corpus.queries, k, 2), store.search(corpus.queries, k, 2)),
+              "round trip: " + name + " mapped search matches in-memory search");
+        remove(path.c_str());
+    }
+}
+
+// the header is 64 bytes: magic[8], version u32, metric u32, dims u64,
+// stride u64, count u64, quantized u32, reserved.
+template <typename T>
+bool rejected(const string& original, size_t offset, T value) {
+    string path = "vector_store_test_corrupt.bin";
+    {
+        ifstream is(original, ios::binary);
+        ofstream os(path, ios::binary);
+        os << is.rdbuf();
+    }
+    {
+        fstream f(path, ios::in | ios::out | ios::binary);
+        f.seekp(offset);
+        f.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    bool thrown = false;
+    try {
+        openai::VectorStore::open(path);
+    } catch (const runtime_error&) {
+        thrown = true;
+    }
+    remove(path.c_str());
+    return thrown;
+}
+
+void corrupt_headers(const Corpus& corpus) {
+    string path = "vector_store_test_valid.bin";
+    openai::VectorStore store(corpus.dims);
+    for (size_t i = 0; i < 8; i++) store.add(corpus.rows[i]);
+    store.save(path);
+
+    check(!rejected(path, 60, uint32_t(0)), "corrupt: untouched reserved bytes still open");
+    check(rejected(path, 12, uint32_t(2)), "corrupt: unknown metric rejected");
+    check(rejected(path, 40, uint32_t(2)), "corrupt: quantized above 1 rejected");
+    check(rejected(path, 16, uint64_t(0) - 3), "corrupt: dims whose padding wraps rejected");
+    check(rejected(path, 32, uint64_t(1) << 62), "corrupt: count too large for the file rejected");
+    check(rejected(path, 32, uint64_t(9)), "corrupt: count one past the file rejected");
+    remove(path.c_str());
+}
+
+int main() {
+    Corpus corpus(2000, 100);
+
+    kernels();
+    search(corpus);
+    round_trip(corpus);
+    corrupt_headers(corpus);
+
+    return failures ? 1 : 0;
+}